@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// keeps the compiler from throwing away a result that is never read
+template <typename T>
+inline void do_not_optimize(const T& value)
+{
+#if defined(_MSC_VER)
+  static volatile const T* sink;
+  sink = &value;
+#else
+  asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// runs fn(i) for i in [0, iterations) and returns the average time of one call
+template <typename Fn>
+double measure_ns(uint32_t iterations, Fn&& fn)
+{
+  // warm up caches and branch predictors
+  for (uint32_t i = 0; i < iterations / 10; ++i)
+    fn(i);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; ++i)
+    fn(i);
+  auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(finish - start).count() / iterations;
+}
+
+inline void print_result(const char* name, double ns)
+{
+  printf("%-40s %10.2f ns\n", name, ns);
+}
@@ -0,0 +1,163 @@
+// ENet's built-in range coder (enet_host_compress_with_range_coder) over w7 snapshot datagrams.
+// Traffic is the generated w7 session from snapshot_traffic.h, framed the way ENet sends it:
+// every snapshot is an unsequenced command with an 8-byte header, commands are batched into
+// datagrams up to the MTU, and the 4-byte protocol header stays uncompressed.
+// Compression is kept only when it makes the datagram smaller, same as enet_protocol_send_outgoing_commands.
+#include "bench.h"
+#include "message_schema.h"
+#include "precision.h"
+#include "snapshot_traffic.h"
+#include <enet/enet.h>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+enum MessageType : uint8_t
+{
+  E_SERVER_TO_CLIENT_SNAPSHOT = 5
+};
+
+// w7 snapshot at full precision: eid, precision level, tick, cell generation parity, x, y, ori
+typedef MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint8_t, precision_level_bits>,
+                      Field<uint16_t>, Field<uint8_t, 1>, Field<uint32_t, 11>, Field<uint32_t, 10>, Field<uint8_t>> SnapshotMsg;
+
+constexpr uint32_t NUM_ENTITIES = 64;
+constexpr uint32_t NUM_TICKS = 2000;
+constexpr float TICK_DT = 0.01f;
+constexpr size_t MTU = 1400;
+constexpr size_t PROTOCOL_HEADER_SIZE = 4;   // peer id + sent time
+constexpr size_t COMMAND_HEADER_SIZE = 8;    // command, channel, reliable seq, unsequenced group, data length
+constexpr uint8_t COMMAND_SEND_UNSEQUENCED = 9 | 0x40;
+
+struct Traffic
+{
+  std::vector<std::vector<uint8_t>> datagrams; // command part only, the protocol header isn't compressed
+  size_t numPackets = 0;
+};
+
+static void put_be16(std::vector<uint8_t> &out, uint16_t v)
+{
+  out.push_back(static_cast<uint8_t>(v >> 8));
+  out.push_back(static_cast<uint8_t>(v));
+}
+
+static void add_command(Traffic &traffic, std::vector<uint8_t> &datagram, uint16_t &group, const uint8_t *data, size_t size)
+{
+  if (datagram.size() + COMMAND_HEADER_SIZE + size > MTU - PROTOCOL_HEADER_SIZE)
+  {
+    traffic.datagrams.push_back(std::move(datagram));
+    datagram.clear();
+  }
+  datagram.push_back(COMMAND_SEND_UNSEQUENCED);
+  datagram.push_back(1); // channel
+  put_be16(datagram, 0);
+  put_be16(datagram, ++group);
+  put_be16(datagram, static_cast<uint16_t>(size));
+  datagram.insert(datagram.end(), data, data + size);
+  ++traffic.numPackets;
+}
+
+// what the w7 server sends by default: a packet per entity, everything sent in a tick goes out in one service call
+static Traffic frame_packet_per_entity(const std::vector<std::vector<QuantizedEntity>> &frames)
+{
+  Traffic traffic;
+  uint16_t group = 0;
+  uint8_t payload[SnapshotMsg::num_bytes];
+  uint16_t tick = 0;
+  for (const auto &frame : frames)
+  {
+    std::vector<uint8_t> datagram;
+    for (const QuantizedEntity &q : frame)
+    {
+      SnapshotMsg::write(payload, q.eid, E_PRECISION_FULL, tick, static_cast<uint8_t>(0), q.x, q.y, q.ori);
+      add_command(traffic, datagram, group, payload, sizeof(payload));
+    }
+    if (!datagram.empty())
+      traffic.datagrams.push_back(std::move(datagram));
+    ++tick;
+  }
+  return traffic;
+}
+
+// w7_server --range-coder: one coded snapshot per tick, baseline 3 ticks behind
+static Traffic frame_range_coded(const std::vector<std::vector<QuantizedEntity>> &frames)
+{
+  Traffic traffic;
+  uint16_t group = 0;
+  SnapshotHistory history;
+  const SnapshotCodingState empty;
+  std::vector<uint8_t> buffer(NUM_ENTITIES * snapshot_max_entity_bytes);
+  for (uint32_t tick = 0; tick < frames.size(); ++tick)
+  {
+    const uint16_t seq = static_cast<uint16_t>(tick);
+    const SnapshotCodingState *base = tick >= 3 ? history.find(seq - 3) : &empty;
+    SnapshotCodingState result;
+    Bitstream bs(buffer.data(), buffer.size());
+    encode_snapshot_body(*base, frames[tick].data(), frames[tick].size(), bs, result);
+    bs.flush();
+    history.store(seq, std::move(result));
+
+    std::vector<uint8_t> datagram;
+    add_command(traffic, datagram, group, buffer.data(), bs.bytes_processed());
+    traffic.datagrams.push_back(std::move(datagram));
+  }
+  return traffic;
+}
+
+static void run(const char *name, const Traffic &traffic)
+{
+  void *context = enet_range_coder_create();
+  std::vector<std::vector<uint8_t>> compressed(traffic.datagrams.size());
+  std::vector<uint8_t> out(MTU);
+
+  size_t rawBytes = 0;
+  size_t sentBytes = 0;
+  size_t numCompressed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < traffic.datagrams.size(); ++i)
+  {
+    const std::vector<uint8_t> &datagram = traffic.datagrams[i];
+    ENetBuffer buffer;
+    buffer.data = const_cast<uint8_t *>(datagram.data());
+    buffer.dataLength = datagram.size();
+    const size_t size = enet_range_coder_compress(context, &buffer, 1, datagram.size(), out.data(), datagram.size());
+    if (size > 0 && size < datagram.size())
+    {
+      compressed[i].assign(out.data(), out.data() + size);
+      ++numCompressed;
+    }
+    rawBytes += PROTOCOL_HEADER_SIZE + datagram.size();
+    sentBytes += PROTOCOL_HEADER_SIZE + (compressed[i].empty() ? datagram.size() : compressed[i].size());
+  }
+  auto finish = std::chrono::steady_clock::now();
+  const double compressNs = std::chrono::duration<double, std::nano>(finish - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < traffic.datagrams.size(); ++i)
+  {
+    if (compressed[i].empty())
+      continue;
+    const size_t size = enet_range_coder_decompress(context, compressed[i].data(), compressed[i].size(), out.data(), out.size());
+    assert(size == traffic.datagrams[i].size() && memcmp(out.data(), traffic.datagrams[i].data(), size) == 0);
+    do_not_optimize(size);
+  }
+  finish = std::chrono::steady_clock::now();
+  const double decompressNs = std::chrono::duration<double, std::nano>(finish - start).count();
+  enet_range_coder_destroy(context);
+
+  printf("%s: %zu packets in %zu datagrams, %zu compressed\n", name, traffic.numPackets, traffic.datagrams.size(), numCompressed);
+  printf("  bytes: %zu -> %zu, saved %.1f%%\n", rawBytes, sentBytes, 100.0 * (1.0 - double(sentBytes) / double(rawBytes)));
+  print_result("  compress per datagram", compressNs / traffic.datagrams.size());
+  print_result("  compress per packet", compressNs / traffic.numPackets);
+  print_result("  decompress per packet", decompressNs / traffic.numPackets);
+}
+
+int main()
+{
+  const auto frames = generate_snapshot_frames(NUM_ENTITIES, NUM_TICKS, TICK_DT);
+  printf("%u entities, %u ticks, MTU %zu\n", NUM_ENTITIES, NUM_TICKS, MTU);
+  run("packet per entity", frame_packet_per_entity(frames));
+  run("range-coded snapshots", frame_range_coded(frames));
+  return 0;
+}
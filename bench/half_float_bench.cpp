@@ -0,0 +1,75 @@
+// float <-> half conversion of a per-tick SoA array (entity sizes, velocities):
+// the portable bit-twiddling conversion one by one vs the batch converters, which use F16C when it's there.
+#include "bench.h"
+#include "half_float.h"
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <vector>
+
+constexpr uint32_t NUM_VALUES = 10'000;
+constexpr uint32_t ITERATIONS = 2'000;
+
+int main()
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> size(1.f, 500.f);
+  std::uniform_real_distribution<float> velocity(-30.f, 30.f);
+
+  std::vector<float> values(NUM_VALUES);
+  for (uint32_t i = 0; i < NUM_VALUES; ++i)
+    values[i] = i % 2 ? size(gen) : velocity(gen);
+  // edges: subnormals, ties, overflow into inf
+  values[0] = 1e-7f;
+  values[1] = 65519.f;
+  values[2] = 65520.f;
+  values[3] = -0.f;
+
+  std::vector<uint16_t> halves(NUM_VALUES);
+  std::vector<float> restored(NUM_VALUES);
+
+  double portableNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    for (uint32_t i = 0; i < NUM_VALUES; ++i)
+      halves[i] = half_float_detail::float_to_half_portable(values[i]);
+    do_not_optimize(halves[NUM_VALUES - 1]);
+  });
+  std::vector<uint16_t> portableHalves = halves;
+
+  double batchNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    floats_to_halves(values.data(), NUM_VALUES, halves.data());
+    do_not_optimize(halves[NUM_VALUES - 1]);
+  });
+
+  double portableBackNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    for (uint32_t i = 0; i < NUM_VALUES; ++i)
+      restored[i] = half_float_detail::half_to_float_portable(halves[i]);
+    do_not_optimize(restored[NUM_VALUES - 1]);
+  });
+
+  double batchBackNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    halves_to_floats(halves.data(), NUM_VALUES, restored.data());
+    do_not_optimize(restored[NUM_VALUES - 1]);
+  });
+
+  double maxRelError = 0.0;
+  for (uint32_t i = 0; i < NUM_VALUES; ++i)
+  {
+    assert(halves[i] == portableHalves[i]);
+    assert(std::bit_cast<uint32_t>(restored[i]) == std::bit_cast<uint32_t>(half_float_detail::half_to_float_portable(halves[i])));
+    if (std::isfinite(restored[i]) && std::fabs(values[i]) >= 6.1e-5f) // normal halves only
+      maxRelError = std::fmax(maxRelError, std::fabs(restored[i] - values[i]) / std::fabs(values[i]));
+  }
+  assert(std::isinf(restored[2]) && restored[1] == 65504.f);
+
+#if defined(HALF_FLOAT_F16C)
+  printf("F16C path enabled\n");
+#else
+  printf("F16C path disabled\n");
+#endif
+  printf("%u values, max relative error %.2e\n", NUM_VALUES, maxRelError);
+  print_result("float -> half, portable one by one", portableNs);
+  print_result("floats_to_halves", batchNs);
+  print_result("half -> float, portable one by one", portableBackNs);
+  print_result("halves_to_floats", batchBackNs);
+  return 0;
+}
@@ -0,0 +1,128 @@
+// One client frame of remote entity interpolation (w5 client): the old per-entity std::map lookup,
+// deque walk and scalar lerp vs one SnapshotFrames::sample pass over SoA frames.
+#include "bench.h"
+#include "snapshot_frames.h"
+#include <cassert>
+#include <deque>
+#include <map>
+#include <random>
+#include <vector>
+
+constexpr uint32_t NUM_ENTITIES = 16'000;
+constexpr uint32_t NUM_SNAPSHOTS = SNAPSHOT_FRAMES;
+constexpr uint32_t SEND_INTERVAL = 13; // ticks, ~10 Hz at TPS=128
+constexpr uint32_t ITERATIONS = 2'000;
+constexpr double FRAME_NS = 1e9 / 60.0;
+
+struct TimedSnapshot
+{
+  uint32_t time;
+  float x;
+  float y;
+  float ori;
+};
+
+struct RemoteEntity
+{
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+
+// what interpolate_entity did per entity before
+void interpolate_entity(std::map<uint16_t, std::deque<TimedSnapshot>> &snapshots, uint16_t eid, RemoteEntity &entity,
+                        uint32_t cur_time)
+{
+  std::deque<TimedSnapshot> &history = snapshots[eid];
+  size_t next = 1;
+  while (cur_time > history[next].time && next + 1 < history.size())
+    ++next;
+  const TimedSnapshot &cur = history[next];
+  const TimedSnapshot &prev = history[next - 1];
+  const float t = static_cast<float>(cur_time - prev.time) / static_cast<float>(cur.time - prev.time);
+  entity.x = prev.x + t * (cur.x - prev.x);
+  entity.y = prev.y + t * (cur.y - prev.y);
+  entity.ori = prev.ori + t * (cur.ori - prev.ori);
+}
+
+int main()
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> pos(-50.f, 50.f);
+  std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+  std::uniform_real_distribution<float> angle(-3.f, 3.f);
+
+  std::map<uint16_t, std::deque<TimedSnapshot>> timedSnapshots;
+  SnapshotFrames frames;
+  for (uint16_t eid = 0; eid < NUM_ENTITIES; ++eid)
+  {
+    float x = pos(gen), y = pos(gen), ori = angle(gen);
+    frames.add_entity(eid, x, y, ori);
+    for (uint32_t s = 0; s < NUM_SNAPSHOTS; ++s)
+    {
+      x += step(gen);
+      y += step(gen);
+      ori += step(gen);
+      const uint32_t tick = s * SEND_INTERVAL;
+      timedSnapshots[eid].push_back({tick, x, y, ori});
+      frames.store(tick, eid, x, y, ori);
+    }
+  }
+
+  std::vector<RemoteEntity> entities(NUM_ENTITIES);
+  const uint32_t lastTick = (NUM_SNAPSHOTS - 1) * SEND_INTERVAL;
+
+  // the old client popped consumed snapshots, so its walk stays at the front
+  double perEntityNs = measure_ns(ITERATIONS, [&](uint32_t i) {
+    const uint32_t renderTime = i % SEND_INTERVAL;
+    for (uint16_t eid = 0; eid < NUM_ENTITIES; ++eid)
+      interpolate_entity(timedSnapshots, eid, entities[eid], renderTime);
+    do_not_optimize(entities[NUM_ENTITIES - 1]);
+  });
+
+  double batchNs = measure_ns(ITERATIONS, [&](uint32_t i) {
+    frames.sample(lastTick / 2 + (i % SEND_INTERVAL) + 0.5);
+    do_not_optimize(frames.xs()[NUM_ENTITIES - 1]);
+  });
+
+  double batchWritebackNs = measure_ns(ITERATIONS, [&](uint32_t i) {
+    frames.sample(lastTick / 2 + (i % SEND_INTERVAL) + 0.5);
+    const float *xs = frames.xs();
+    const float *ys = frames.ys();
+    const float *oris = frames.oris();
+    for (uint16_t eid = 0; eid < NUM_ENTITIES; ++eid)
+      entities[eid] = {xs[eid], ys[eid], oris[eid]};
+    do_not_optimize(entities[NUM_ENTITIES - 1]);
+  });
+
+  // both agree away from the angle wrap, the batch one takes the shorter arc there
+  const double renderTick = lastTick / 2 + 0.5;
+  frames.sample(renderTick);
+  for (uint16_t eid = 0; eid < NUM_ENTITIES; ++eid)
+  {
+    const std::deque<TimedSnapshot> &history = timedSnapshots[eid];
+    const TimedSnapshot &prev = history[lastTick / 2 / SEND_INTERVAL];
+    const TimedSnapshot &next = history[lastTick / 2 / SEND_INTERVAL + 1];
+    const float t = static_cast<float>((renderTick - prev.time) / SEND_INTERVAL);
+    assert(std::fabs(frames.xs()[eid] - (prev.x + t * (next.x - prev.x))) < 1e-4f);
+    assert(std::fabs(frames.ys()[eid] - (prev.y + t * (next.y - prev.y))) < 1e-4f);
+  }
+  float wrapped[4];
+  const float from[4] = {3.1f, -3.1f, 0.f, 1.f};
+  const float to[4] = {-3.1f, 3.1f, 1.f, 0.f};
+  lerp_angle_batch(from, to, 0.5f, 4, wrapped);
+  assert(std::fabs(std::fabs(wrapped[0]) - 3.1416f) < 1e-3f && std::fabs(std::fabs(wrapped[1]) - 3.1416f) < 1e-3f);
+  assert(std::fabs(wrapped[2] - 0.5f) < 1e-6f && std::fabs(wrapped[3] - 0.5f) < 1e-6f);
+
+#if defined(INTERPOLATION_SSE2)
+  printf("SSE2 path enabled\n");
+#else
+  printf("SSE2 path disabled\n");
+#endif
+  printf("%u remote entities, %u snapshots each\n", NUM_ENTITIES, NUM_SNAPSHOTS);
+  print_result("per entity map + deque + lerp", perEntityNs);
+  print_result("SnapshotFrames::sample", batchNs);
+  print_result("SnapshotFrames::sample + writeback", batchWritebackNs);
+  printf("of a 60 Hz frame: %.2f%% vs %.2f%%\n", perEntityNs / FRAME_NS * 100.0, batchWritebackNs / FRAME_NS * 100.0);
+  return 0;
+}
@@ -0,0 +1,92 @@
+// One server tick of simulate_entity (w7) over 128k entities: the serial loop vs JobSystem::parallel_for
+// on 1..N threads, and a check that every thread count ends up with the serial loop's bits.
+#include "bench.h"
+#include "entity.h"
+#include "job_system.h"
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t NUM_ENTITIES = 128'000;
+constexpr uint32_t GRAIN = 1024;
+constexpr uint32_t ITERATIONS = 200;
+constexpr uint32_t DETERMINISM_TICKS = 100;
+constexpr float DT = 0.01f;
+
+bool same_state(const std::vector<Entity> &a, const std::vector<Entity> &b)
+{
+  for (size_t i = 0; i < a.size(); ++i)
+    if (memcmp(&a[i].x, &b[i].x, sizeof(float)) || memcmp(&a[i].y, &b[i].y, sizeof(float)) ||
+        memcmp(&a[i].speed, &b[i].speed, sizeof(float)) || memcmp(&a[i].ori, &b[i].ori, sizeof(float)))
+      return false;
+  return true;
+}
+
+void simulate_parallel(JobSystem &jobs, std::vector<Entity> &entities)
+{
+  jobs.parallel_for(static_cast<uint32_t>(entities.size()), GRAIN, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i)
+      simulate_entity(entities[i], DT);
+  });
+}
+
+int main()
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> pos(-500.f, 500.f);
+  std::uniform_real_distribution<float> control(-1.f, 1.f);
+  std::uniform_real_distribution<float> angle(-3.f, 3.f);
+
+  std::vector<Entity> initial(NUM_ENTITIES);
+  for (Entity &e : initial)
+  {
+    e.x = pos(gen);
+    e.y = pos(gen);
+    e.ori = angle(gen);
+    e.thr = control(gen);
+    e.steer = control(gen);
+  }
+
+  std::vector<Entity> serial = initial;
+  for (uint32_t t = 0; t < DETERMINISM_TICKS; ++t)
+    for (Entity &e : serial)
+      simulate_entity(e, DT);
+
+  std::vector<Entity> entities = initial;
+  const double serialNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    for (Entity &e : entities)
+      simulate_entity(e, DT);
+    do_not_optimize(entities.back());
+  });
+
+  const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+  printf("%u entities, grain %u, %u hardware threads\n", NUM_ENTITIES, GRAIN, cores);
+  print_result("serial loop", serialNs);
+
+  bool deterministic = true;
+  for (uint32_t threads = 1; threads <= cores; threads *= 2)
+  {
+    JobSystem jobs(threads);
+
+    std::vector<Entity> check = initial;
+    for (uint32_t t = 0; t < DETERMINISM_TICKS; ++t)
+      simulate_parallel(jobs, check);
+    deterministic = deterministic && same_state(check, serial);
+
+    entities = initial;
+    const double ns = measure_ns(ITERATIONS, [&](uint32_t) {
+      simulate_parallel(jobs, entities);
+      do_not_optimize(entities.back());
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "parallel_for, %u threads", threads);
+    print_result(name, ns);
+    printf("%40s %10.2fx\n", "speedup over serial", serialNs / ns);
+    if (threads < cores && threads * 2 > cores)
+      threads = cores / 2; // the last round runs on every core
+  }
+
+  printf("same bits as the serial loop on every thread count: %s\n", deterministic ? "yes" : "NO");
+  return deterministic ? 0 : 1;
+}
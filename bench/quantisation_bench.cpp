@@ -0,0 +1,78 @@
+// Per-tick quantisation of all entity positions and orientations (w7 snapshot layout):
+// the old per-value pack_float with runtime ranges and a divide vs PackedFloatN batch packing over SoA arrays.
+#include "bench.h"
+#include "quantisation.h"
+#include <cassert>
+#include <random>
+#include <vector>
+
+constexpr uint32_t NUM_ENTITIES = 10'000;
+constexpr uint32_t ITERATIONS = 2'000;
+
+int main()
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> posX(-18.f, 18.f);
+  std::uniform_real_distribution<float> posY(-9.f, 9.f);
+  std::uniform_real_distribution<float> angle(-pi, pi);
+
+  std::vector<float> xs(NUM_ENTITIES), ys(NUM_ENTITIES), oris(NUM_ENTITIES);
+  for (uint32_t i = 0; i < NUM_ENTITIES; ++i)
+  {
+    xs[i] = posX(gen);
+    ys[i] = posY(gen);
+    oris[i] = angle(gen);
+  }
+
+  std::vector<uint32_t> posPacked(NUM_ENTITIES);
+  std::vector<uint8_t> oriPacked(NUM_ENTITIES);
+
+  double runtimeNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    for (uint32_t i = 0; i < NUM_ENTITIES; ++i)
+    {
+      posPacked[i] = pack_float<uint32_t>(xs[i], -16.f, 16.f, 11) << 10 | pack_float<uint32_t>(ys[i], -8.f, 8.f, 10);
+      oriPacked[i] = pack_float<uint8_t>(oris[i], -pi, pi, 8);
+    }
+    do_not_optimize(posPacked[NUM_ENTITIES - 1]);
+  });
+
+  double perValueNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    for (uint32_t i = 0; i < NUM_ENTITIES; ++i)
+    {
+      posPacked[i] = PositionQuantized({xs[i], ys[i]}).packedVal;
+      oriPacked[i] = OrientationQuantized(oris[i]).packedVal;
+    }
+    do_not_optimize(posPacked[NUM_ENTITIES - 1]);
+  });
+
+  double batchNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    PositionQuantized::pack_batch(posPacked.data(), NUM_ENTITIES, xs.data(), ys.data());
+    OrientationQuantized::pack_batch(oriPacked.data(), NUM_ENTITIES, oris.data());
+    do_not_optimize(posPacked[NUM_ENTITIES - 1]);
+  });
+
+  std::vector<float> xsOut(NUM_ENTITIES), ysOut(NUM_ENTITIES);
+  double unpackNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    PositionQuantized::unpack_batch(posPacked.data(), NUM_ENTITIES, xsOut.data(), ysOut.data());
+    do_not_optimize(xsOut[NUM_ENTITIES - 1]);
+  });
+
+  for (uint32_t i = 0; i < NUM_ENTITIES; ++i)
+  {
+    assert(posPacked[i] == PositionQuantized({xs[i], ys[i]}).packedVal);
+    assert(oriPacked[i] == OrientationQuantized(oris[i]).packedVal);
+  }
+
+#if defined(QUANTISATION_SSE2)
+  printf("SSE2 path enabled\n");
+#else
+  printf("SSE2 path disabled\n");
+#endif
+  printf("%u entities per tick\n", NUM_ENTITIES);
+  print_result("pack_float, runtime ranges", runtimeNs);
+  print_result("PackedFloatN one by one", perValueNs);
+  print_result("PackedFloatN::pack_batch", batchNs);
+  print_result("PackedFloatN::unpack_batch (position)", unpackNs);
+  printf("per entity: %.2f ns\n", batchNs / NUM_ENTITIES);
+  return 0;
+}
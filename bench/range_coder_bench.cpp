@@ -0,0 +1,78 @@
+// Range-coded w7 snapshots vs the plain formats, over the generated w7 session from snapshot_traffic.h.
+// The client acks with a delay of a few ticks, so every snapshot is coded against an older baseline.
+#include "bench.h"
+#include "snapshot_traffic.h"
+#include <cassert>
+#include <chrono>
+#include <vector>
+
+constexpr uint32_t NUM_ENTITIES = 256;
+constexpr uint32_t NUM_TICKS = 2000;
+constexpr float TICK_DT = 0.01f;
+// acked baseline is this many ticks behind
+constexpr uint16_t ACK_DELAY = 3;
+
+int main()
+{
+  const auto frames = generate_snapshot_frames(NUM_ENTITIES, NUM_TICKS, TICK_DT);
+
+  std::vector<std::vector<uint8_t>> packets(NUM_TICKS);
+  std::vector<uint8_t> buffer(NUM_ENTITIES * snapshot_max_entity_bytes);
+  const SnapshotCodingState empty;
+  size_t codedBytes = 0;
+
+  SnapshotHistory serverHistory;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t tick = 0; tick < NUM_TICKS; ++tick)
+  {
+    const uint16_t seq = static_cast<uint16_t>(tick);
+    const SnapshotCodingState *base = tick >= ACK_DELAY ? serverHistory.find(seq - ACK_DELAY) : &empty;
+    SnapshotCodingState result;
+    Bitstream bs(buffer.data(), buffer.size());
+    encode_snapshot_body(*base, frames[tick].data(), frames[tick].size(), bs, result);
+    bs.flush();
+    assert(!bs.overflow());
+    packets[tick].assign(buffer.data(), buffer.data() + bs.bytes_processed());
+    codedBytes += bs.bytes_processed();
+    serverHistory.store(seq, std::move(result));
+  }
+  auto finish = std::chrono::steady_clock::now();
+  const double encodeNs = std::chrono::duration<double, std::nano>(finish - start).count();
+
+  SnapshotHistory clientHistory;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t tick = 0; tick < NUM_TICKS; ++tick)
+  {
+    const uint16_t seq = static_cast<uint16_t>(tick);
+    const SnapshotCodingState *base = tick >= ACK_DELAY ? clientHistory.find(seq - ACK_DELAY) : &empty;
+    SnapshotCodingState result;
+    Bitstream bs(packets[tick].data(), packets[tick].size());
+    const bool ok = decode_snapshot_body(*base, bs, result);
+    assert(ok);
+    do_not_optimize(ok);
+    clientHistory.store(seq, std::move(result));
+  }
+  finish = std::chrono::steady_clock::now();
+  const double decodeNs = std::chrono::duration<double, std::nano>(finish - start).count();
+
+  for (uint32_t tick = NUM_TICKS - 32; tick < NUM_TICKS; ++tick)
+  {
+    const SnapshotCodingState *decoded = clientHistory.find(static_cast<uint16_t>(tick));
+    assert(decoded && decoded->entities.size() == NUM_ENTITIES);
+    for (uint32_t i = 0; i < NUM_ENTITIES; ++i)
+      assert(decoded->entities[i].x == frames[tick][i].x && decoded->entities[i].ori == frames[tick][i].ori);
+  }
+
+  const double entitySnapshots = double(NUM_TICKS) * NUM_ENTITIES;
+  // a packet per entity at full precision vs the same fields bit-packed back to back
+  const double perPacketBytes = entitySnapshots * 9;
+  const double packedBytes = entitySnapshots * (16 + 11 + 10 + 8) / 8.0;
+  printf("%u entities, %u ticks, baseline %u ticks behind\n", NUM_ENTITIES, NUM_TICKS, ACK_DELAY);
+  printf("packet per entity:   %8.2f bytes/entity\n", perPacketBytes / entitySnapshots);
+  printf("bit-packed:          %8.2f bytes/entity\n", packedBytes / entitySnapshots);
+  printf("range coded:         %8.2f bytes/entity (%.1fx smaller than bit-packed)\n",
+         codedBytes / entitySnapshots, packedBytes / codedBytes);
+  print_result("encode per entity", encodeNs / entitySnapshots);
+  print_result("decode per entity", decodeNs / entitySnapshots);
+  return 0;
+}
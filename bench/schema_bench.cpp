@@ -0,0 +1,95 @@
+// Hand-written Bitstream serialisation vs generated MessageSchema writer / MessageView reader
+// for the w7 snapshot layout (type, eid, 21 bits of position, 8 bits of orientation).
+#include "bench.h"
+#include "message_schema.h"
+#include <cassert>
+#include <vector>
+
+enum MessageType : uint8_t
+{
+  E_SERVER_TO_CLIENT_SNAPSHOT = 5
+};
+
+typedef MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint32_t, 21>, Field<uint8_t>> SnapshotMsg;
+static_assert(SnapshotMsg::num_bytes == 7);
+static_assert(SnapshotMsg::bit_offset<2>() == 8 + 16 + 21);
+
+constexpr uint32_t NUM_PACKETS = 4096;
+constexpr uint32_t ITERATIONS = 1'000'000;
+
+struct SnapshotData
+{
+  uint16_t eid;
+  uint32_t pos;
+  uint8_t ori;
+};
+
+static void write_by_hand(uint8_t* data, const SnapshotData& s)
+{
+  auto bs = Bitstream(data, bits_to_bytes(8 + 16 + 21 + 8));
+  bs.write(E_SERVER_TO_CLIENT_SNAPSHOT);
+  bs.write(s.eid);
+  bs.write_bits(s.pos, 21);
+  bs.write_bits(s.ori, 8);
+  bs.flush();
+}
+
+static SnapshotData read_by_hand(uint8_t* data)
+{
+  auto bs = Bitstream(data, bits_to_bytes(8 + 16 + 21 + 8));
+  MessageType type{};
+  SnapshotData s{};
+  bs.read(type);
+  bs.read(s.eid);
+  s.pos = bs.read_bits(21);
+  s.ori = static_cast<uint8_t>(bs.read_bits(8));
+  return s;
+}
+
+int main()
+{
+  std::vector<SnapshotData> input(NUM_PACKETS);
+  for (uint32_t i = 0; i < NUM_PACKETS; ++i)
+    input[i] = {static_cast<uint16_t>(i), (i * 2654435761u) & 0x1fffff, static_cast<uint8_t>(i * 7)};
+
+  std::vector<uint8_t> handBuffer(NUM_PACKETS * SnapshotMsg::num_bytes);
+  std::vector<uint8_t> schemaBuffer(NUM_PACKETS * SnapshotMsg::num_bytes);
+
+  double handWrite = measure_ns(ITERATIONS, [&](uint32_t i) {
+    const uint32_t idx = i % NUM_PACKETS;
+    write_by_hand(&handBuffer[idx * SnapshotMsg::num_bytes], input[idx]);
+    do_not_optimize(handBuffer[idx * SnapshotMsg::num_bytes]);
+  });
+  double schemaWrite = measure_ns(ITERATIONS, [&](uint32_t i) {
+    const uint32_t idx = i % NUM_PACKETS;
+    const SnapshotData& s = input[idx];
+    SnapshotMsg::write(&schemaBuffer[idx * SnapshotMsg::num_bytes], s.eid, s.pos, s.ori);
+    do_not_optimize(schemaBuffer[idx * SnapshotMsg::num_bytes]);
+  });
+  assert(handBuffer == schemaBuffer);
+
+  double handRead = measure_ns(ITERATIONS, [&](uint32_t i) {
+    const uint32_t idx = i % NUM_PACKETS;
+    SnapshotData s = read_by_hand(&handBuffer[idx * SnapshotMsg::num_bytes]);
+    do_not_optimize(s);
+  });
+  double viewRead = measure_ns(ITERATIONS, [&](uint32_t i) {
+    const uint32_t idx = i % NUM_PACKETS;
+    MessageView<SnapshotMsg> view(&schemaBuffer[idx * SnapshotMsg::num_bytes], SnapshotMsg::num_bytes);
+    SnapshotData s = {view.get<0>(), view.get<1>(), view.get<2>()};
+    do_not_optimize(s);
+  });
+
+  for (uint32_t i = 0; i < NUM_PACKETS; ++i)
+  {
+    MessageView<SnapshotMsg> view(&schemaBuffer[i * SnapshotMsg::num_bytes], SnapshotMsg::num_bytes);
+    assert(view.valid() && view.get<0>() == input[i].eid && view.get<1>() == input[i].pos && view.get<2>() == input[i].ori);
+  }
+
+  printf("snapshot message, %zu bytes\n", SnapshotMsg::num_bytes);
+  print_result("write: hand-written Bitstream", handWrite);
+  print_result("write: MessageSchema", schemaWrite);
+  print_result("read: hand-written Bitstream", handRead);
+  print_result("read: MessageView", viewRead);
+  return 0;
+}
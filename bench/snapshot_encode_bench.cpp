@@ -0,0 +1,142 @@
+// Snapshot encoding for 1k peers (w7 range-coded snapshots), each peer with its own subset of the
+// world and its own baseline: the serial peer loop vs the parallel phase on 1..N threads, packets
+// captured into a PacketBatch and dropped instead of handed to ENet. Checks every thread count
+// produces the serial loop's bytes for every peer. Run it on the server's machine before raising
+// --sim-threads there: on a single hardware thread it only shows the overhead of the parallel phase.
+#include "bench.h"
+#include "job_system.h"
+#include "packet_batch.h"
+#include "protocol.h"
+#include "snapshot_traffic.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t NUM_PEERS = 1'000;
+constexpr uint32_t NUM_ENTITIES = 8'000;
+constexpr uint32_t ENTITIES_PER_PEER = 400;
+constexpr uint32_t PEER_GRAIN = 16;
+constexpr uint32_t ITERATIONS = 20;
+constexpr float DT = 0.01f;
+
+struct BenchPeer
+{
+  std::vector<QuantizedEntity> baseline; // what the peer has acked
+  std::vector<QuantizedEntity> current;
+  SnapshotCodingState baseState;
+};
+
+// a window of the world around the peer, sorted by eid like the server sends it
+std::vector<QuantizedEntity> peer_subset(const std::vector<QuantizedEntity> &frame, uint32_t peer)
+{
+  std::vector<QuantizedEntity> subset;
+  const uint32_t first = static_cast<uint32_t>((uint64_t(peer) * 7919) % NUM_ENTITIES);
+  for (uint32_t i = 0; i < ENTITIES_PER_PEER; ++i)
+    subset.push_back(frame[(first + i) % NUM_ENTITIES]);
+  std::sort(subset.begin(), subset.end(), [](const QuantizedEntity &a, const QuantizedEntity &b) { return a.eid < b.eid; });
+  return subset;
+}
+
+bool encode_peer(std::vector<ENetPeer> &enetPeers, std::vector<BenchPeer> &peers, PacketBatch &batch, uint32_t i)
+{
+  PacketCapture capture(batch, i);
+  SnapshotCodingState result;
+  return send_coded_snapshot(&enetPeers[i], 1, &peers[i].baseState, 0, peers[i].current.data(), peers[i].current.size(), result);
+}
+
+void drop_all(PacketBatch &batch)
+{
+  for (size_t i = 0; i < batch.size(); ++i)
+  {
+    for (const PendingPacket &pending : batch.slot(i))
+      enet_packet_destroy(pending.packet);
+    batch.slot(i).clear();
+  }
+}
+
+int main()
+{
+  const std::vector<std::vector<QuantizedEntity>> frames = generate_snapshot_frames(NUM_ENTITIES, 11, DT);
+
+  std::vector<ENetPeer> enetPeers(NUM_PEERS);
+  std::vector<BenchPeer> peers(NUM_PEERS);
+  PacketBatch batch;
+  batch.resize(NUM_PEERS);
+  for (uint32_t i = 0; i < NUM_PEERS; ++i)
+  {
+    // baseline 10 ticks back, what an acked snapshot at 100 ms RTT looks like
+    peers[i].baseline = peer_subset(frames[0], i);
+    peers[i].current = peer_subset(frames[10], i);
+    PacketCapture capture(batch, i);
+    if (!send_coded_snapshot(&enetPeers[i], 0, nullptr, 0, peers[i].baseline.data(), peers[i].baseline.size(), peers[i].baseState))
+    {
+      printf("baseline snapshot of peer %u doesn't fit into a packet\n", i);
+      return 1;
+    }
+  }
+  drop_all(batch);
+
+  // reference bytes from the serial loop
+  for (uint32_t i = 0; i < NUM_PEERS; ++i)
+    if (!encode_peer(enetPeers, peers, batch, i))
+    {
+      printf("snapshot of peer %u doesn't fit into a packet\n", i);
+      return 1;
+    }
+  std::vector<std::vector<uint8_t>> reference(NUM_PEERS);
+  size_t totalBytes = 0;
+  for (uint32_t i = 0; i < NUM_PEERS; ++i)
+  {
+    const ENetPacket *packet = batch.slot(i).front().packet;
+    reference[i].assign(packet->data, packet->data + packet->dataLength);
+    totalBytes += packet->dataLength;
+  }
+  drop_all(batch);
+
+  const double serialNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    for (uint32_t i = 0; i < NUM_PEERS; ++i)
+      encode_peer(enetPeers, peers, batch, i);
+    drop_all(batch);
+  });
+
+  const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+  printf("%u peers, %u of %u entities each, %.1f bytes per snapshot, %u hardware threads\n", NUM_PEERS,
+         ENTITIES_PER_PEER, NUM_ENTITIES, double(totalBytes) / NUM_PEERS, cores);
+  print_result("serial peer loop", serialNs);
+
+  bool identical = true;
+  for (uint32_t threads = 1; threads <= cores; threads *= 2)
+  {
+    JobSystem jobs(threads);
+    auto encode_all = [&]() {
+      jobs.parallel_for(NUM_PEERS, PEER_GRAIN, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i)
+          encode_peer(enetPeers, peers, batch, i);
+      });
+    };
+
+    encode_all();
+    for (uint32_t i = 0; i < NUM_PEERS; ++i)
+    {
+      const ENetPacket *packet = batch.slot(i).front().packet;
+      identical = identical && packet->dataLength == reference[i].size() &&
+                  memcmp(packet->data, reference[i].data(), packet->dataLength) == 0;
+    }
+    drop_all(batch);
+
+    const double ns = measure_ns(ITERATIONS, [&](uint32_t) {
+      encode_all();
+      drop_all(batch);
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "parallel encode, %u threads", threads);
+    print_result(name, ns);
+    printf("%40s %10.2fx\n", "speedup over serial", serialNs / ns);
+    if (threads < cores && threads * 2 > cores)
+      threads = cores / 2; // the last round runs on every core
+  }
+
+  printf("same bytes as the serial loop for every peer: %s\n", identical ? "yes" : "NO");
+  return identical ? 0 : 1;
+}
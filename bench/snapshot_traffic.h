@@ -0,0 +1,60 @@
+#pragma once
+
+#include "entity.h"
+#include "quantisation.h"
+#include "snapshot_coder.h"
+#include <random>
+#include <vector>
+
+// Deterministic stand-in for a recorded w7 session: entities drive with random inputs held for
+// a while, every 8th one is parked, and the full-precision snapshot codes of every tick are kept.
+// Same seed, same traffic.
+inline std::vector<std::vector<QuantizedEntity>> generate_snapshot_frames(uint32_t num_entities, uint32_t num_ticks,
+                                                                          float dt, uint32_t seed = 42)
+{
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> input(-1, 1);
+  std::uniform_int_distribution<int> holdTicks(20, 200);
+  std::uniform_real_distribution<float> posX(-15.f, 15.f);
+  std::uniform_real_distribution<float> posY(-7.f, 7.f);
+
+  std::vector<Entity> world(num_entities);
+  std::vector<int> hold(num_entities, 0);
+  for (uint32_t i = 0; i < num_entities; ++i)
+  {
+    world[i].eid = static_cast<uint16_t>(i * 3 + (i % 3)); // ascending with gaps
+    world[i].x = posX(gen);
+    world[i].y = posY(gen);
+    world[i].cell = cell_of(world[i].x, world[i].y);
+  }
+
+  std::vector<std::vector<QuantizedEntity>> frames(num_ticks);
+  for (uint32_t tick = 0; tick < num_ticks; ++tick)
+  {
+    frames[tick].reserve(num_entities);
+    for (uint32_t i = 0; i < num_entities; ++i)
+    {
+      Entity &e = world[i];
+      if (--hold[i] <= 0)
+      {
+        e.thr = i % 8 == 0 ? 0.f : static_cast<float>(input(gen));
+        e.steer = static_cast<float>(input(gen));
+        hold[i] = holdTicks(gen);
+      }
+      simulate_entity(e, dt);
+      // keep them on the map, like the players do
+      if (e.x < -16.f || e.x > 16.f || e.y < -8.f || e.y > 8.f)
+      {
+        e.x = clamp(e.x, -16.f, 16.f);
+        e.y = clamp(e.y, -8.f, 8.f);
+        e.ori += pi;
+      }
+      update_cell(e.cell, e.x, e.y);
+      PositionQuantized pos({e.x - cell_origin_x(e.cell), e.y - cell_origin_y(e.cell)});
+      frames[tick].push_back({e.eid, static_cast<uint16_t>(pos.packedVal >> 10),
+                              static_cast<uint16_t>(pos.packedVal & 0x3ff), OrientationQuantized(e.ori).packedVal,
+                              e.cell.x, e.cell.y});
+    }
+  }
+  return frames;
+}
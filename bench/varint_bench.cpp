@@ -0,0 +1,102 @@
+// Decoding an aggregated snapshot's entity id list (ascending ids with small gaps, delta + zigzag coded)
+// and a list of small signed position deltas: the batch decoder w5 snapshots use, its scalar fallback,
+// and the bitstream prefix varint one value at a time.
+#include "bench.h"
+#include "varint.h"
+#include <random>
+#include <vector>
+
+constexpr uint32_t NUM_IDS = 4096;
+constexpr uint32_t ITERATIONS = 20'000;
+
+int main()
+{
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<uint32_t> gap(1, 6);
+  std::normal_distribution<float> delta(0.f, 40.f);
+
+  std::vector<uint32_t> ids(NUM_IDS);
+  std::vector<int32_t> deltas(NUM_IDS);
+  uint32_t id = 0;
+  for (uint32_t i = 0; i < NUM_IDS; ++i)
+  {
+    id += gap(gen);
+    ids[i] = id;
+    deltas[i] = static_cast<int32_t>(delta(gen));
+  }
+
+  std::vector<uint32_t> scratch(NUM_IDS);
+  std::vector<uint8_t> idBatch(varint_batch_max_size(NUM_IDS));
+  std::vector<uint8_t> deltaBatch(varint_batch_max_size(NUM_IDS));
+  const size_t idBatchSize = encode_delta_batch(ids.data(), NUM_IDS, scratch.data(), idBatch.data());
+  for (uint32_t i = 0; i < NUM_IDS; ++i)
+    scratch[i] = zigzag_encode(deltas[i]);
+  const size_t deltaBatchSize = encode_uint_batch(scratch.data(), NUM_IDS, deltaBatch.data());
+
+  // the decoded values of every pass are checked after it, with or without NDEBUG
+  bool roundTrip = true;
+  std::vector<uint32_t> out(NUM_IDS);
+  auto check_deltas = [&] {
+    for (uint32_t i = 0; i < NUM_IDS; ++i)
+      roundTrip = roundTrip && zigzag_decode(out[i]) == deltas[i];
+  };
+
+  const double scalarNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    decode_uint_batch_scalar(deltaBatch.data(), deltaBatchSize, NUM_IDS, out.data());
+    do_not_optimize(out[NUM_IDS - 1]);
+  });
+  check_deltas();
+  const double batchNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    decode_uint_batch(deltaBatch.data(), deltaBatchSize, NUM_IDS, out.data());
+    do_not_optimize(out[NUM_IDS - 1]);
+  });
+  check_deltas();
+  const double idsNs = measure_ns(ITERATIONS, [&](uint32_t) {
+    decode_delta_batch(idBatch.data(), idBatchSize, NUM_IDS, out.data());
+    do_not_optimize(out[NUM_IDS - 1]);
+  });
+  roundTrip = roundTrip && out == ids;
+  // a batch cut short is refused, not read past its end
+  roundTrip = roundTrip && decode_delta_batch(idBatch.data(), idBatchSize - 1, NUM_IDS, out.data()) == 0;
+
+  // one value at a time through the bitstream prefix varint, what a per-field decoder would do
+  std::vector<uint8_t> streamBytes(NUM_IDS * 9);
+  Bitstream writer(streamBytes.data(), streamBytes.size());
+  for (uint32_t i = 0; i < NUM_IDS; ++i)
+    write_zigzag(writer, deltas[i]);
+  writer.flush();
+  const double streamNs = measure_ns(ITERATIONS / 10, [&](uint32_t) {
+    Bitstream reader(streamBytes.data(), writer.bytes_processed());
+    for (uint32_t i = 0; i < NUM_IDS; ++i)
+      out[i] = zigzag_encode(static_cast<int32_t>(read_zigzag(reader)));
+    do_not_optimize(out[NUM_IDS - 1]);
+  });
+  check_deltas();
+
+  // every length class of the prefix varint, the 9 byte code included, comes back whole
+  const uint64_t edges[] = {0, 127, 128, 16383, 16384, (1ull << 30) - 1, 1ull << 30, (1ull << 56) - 1, 1ull << 56, ~0ull};
+  uint8_t edgeBytes[sizeof(edges) / sizeof(edges[0]) * 9];
+  Bitstream edgeWriter(edgeBytes, sizeof(edgeBytes));
+  for (uint64_t value : edges)
+    write_varint(edgeWriter, value);
+  edgeWriter.flush();
+  Bitstream edgeReader(edgeBytes, edgeWriter.bytes_processed());
+  roundTrip = roundTrip && !edgeWriter.overflow();
+  for (uint64_t value : edges)
+    roundTrip = roundTrip && read_varint(edgeReader) == value;
+
+#if defined(__SSSE3__)
+  printf("SSSE3 path enabled\n");
+#else
+  printf("SSSE3 path disabled, configure with -DNETWORKED_NATIVE_ARCH=ON\n");
+#endif
+  printf("%u ids: %zu bytes, %u deltas: %zu bytes (bitstream varint: %u bytes)\n", NUM_IDS, idBatchSize, NUM_IDS,
+         deltaBatchSize, writer.bytes_processed());
+  print_result("deltas: scalar batch decode", scalarNs);
+  print_result("deltas: batch decode", batchNs);
+  print_result("ids: batch decode + prefix sum", idsNs);
+  print_result("deltas: bitstream varint one by one", streamNs);
+  printf("per id: %.2f ns\n", idsNs / NUM_IDS);
+  printf("every value decoded back: %s\n", roundTrip ? "yes" : "NO");
+  return roundTrip ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+// Wire format is little-endian: bits are packed LSB first into 32-bit words,
+// words are stored in little-endian byte order. On big-endian hosts
+// only the word loads/stores get swapped, which is resolved at compile time.
+
+inline uint16_t byteswap(uint16_t v)
+{
+#if defined(_MSC_VER)
+  return _byteswap_ushort(v);
+#else
+  return __builtin_bswap16(v);
+#endif
+}
+
+inline uint32_t byteswap(uint32_t v)
+{
+#if defined(_MSC_VER)
+  return _byteswap_ulong(v);
+#else
+  return __builtin_bswap32(v);
+#endif
+}
+
+inline uint64_t byteswap(uint64_t v)
+{
+#if defined(_MSC_VER)
+  return _byteswap_uint64(v);
+#else
+  return __builtin_bswap64(v);
+#endif
+}
+
+template <typename T>
+inline T to_wire_endian(T v)
+{
+  if constexpr (std::endian::native == std::endian::little)
+    return v;
+  else
+    return byteswap(v);
+}
+
+template <typename T>
+inline T from_wire_endian(T v)
+{
+  return to_wire_endian(v);
+}
+
+constexpr uint32_t bits_to_bytes(uint32_t num_bits)
+{
+  return (num_bits + 7) / 8;
+}
+
+class Bitstream {
+public:
+  Bitstream(uint8_t* data_ptr, size_t size)
+    : data_ptr_(data_ptr),
+      size_bits_(static_cast<uint32_t>(size) * 8) {
+  }
+
+  // num_bits in [1, 32], value must fit into num_bits
+  void write_bits(uint32_t value, uint32_t num_bits) {
+    if (!reserve_bits(num_bits))
+      return;
+
+    scratch_ |= static_cast<uint64_t>(value & low_mask(num_bits)) << scratch_bits_;
+    scratch_bits_ += num_bits;
+    if (scratch_bits_ >= 32)
+    {
+      // every bit of this word is already accounted in bits_processed_, so it fits into the buffer
+      const uint32_t word = to_wire_endian(static_cast<uint32_t>(scratch_));
+      memcpy(data_ptr_ + byte_offset_, &word, sizeof(uint32_t));
+      byte_offset_ += sizeof(uint32_t);
+      scratch_ >>= 32;
+      scratch_bits_ -= 32;
+    }
+  }
+
+  uint32_t read_bits(uint32_t num_bits) {
+    if (!reserve_bits(num_bits))
+      return 0;
+
+    if (scratch_bits_ < num_bits)
+    {
+      const uint32_t size_bytes = size_bits_ / 8;
+      if (byte_offset_ + sizeof(uint32_t) <= size_bytes)
+      {
+        uint32_t word = 0;
+        memcpy(&word, data_ptr_ + byte_offset_, sizeof(uint32_t));
+        scratch_ |= static_cast<uint64_t>(from_wire_endian(word)) << scratch_bits_;
+        scratch_bits_ += 32;
+        byte_offset_ += sizeof(uint32_t);
+      }
+      else
+      {
+        // buffer tail is shorter than a word
+        while (scratch_bits_ < num_bits)
+        {
+          scratch_ |= static_cast<uint64_t>(data_ptr_[byte_offset_++]) << scratch_bits_;
+          scratch_bits_ += 8;
+        }
+      }
+    }
+
+    const auto value = static_cast<uint32_t>(scratch_ & low_mask(num_bits));
+    scratch_ >>= num_bits;
+    scratch_bits_ -= num_bits;
+    return value;
+  }
+
+  void write_bool(bool value) { write_bits(value ? 1 : 0, 1); }
+  bool read_bool() { return read_bits(1) != 0; }
+
+  // Arithmetic types and enums go through write_bits, so their wire layout is
+  // endian independent. Other trivially copyable types are copied byte by byte as they are in memory.
+  template <typename Type>
+  void write(const Type& data) {
+    static_assert(std::is_trivially_copyable_v<Type>, "ASSERT: type can't be copied to the wire");
+    if constexpr (std::is_arithmetic_v<Type> || std::is_enum_v<Type>)
+    {
+      if constexpr (sizeof(Type) <= sizeof(uint32_t))
+      {
+        uint32_t value = 0;
+        memcpy(&value, &data, sizeof(Type));
+        if constexpr (std::endian::native == std::endian::big)
+          value >>= 32 - sizeof(Type) * 8;
+        write_bits(value, sizeof(Type) * 8);
+      }
+      else
+      {
+        const auto value = std::bit_cast<uint64_t>(data);
+        write_bits(static_cast<uint32_t>(value), 32);
+        write_bits(static_cast<uint32_t>(value >> 32), 32);
+      }
+    }
+    else
+    {
+      const auto* bytes = reinterpret_cast<const uint8_t*>(&data);
+      for (size_t i = 0; i < sizeof(Type); ++i)
+        write_bits(bytes[i], 8);
+    }
+  }
+
+  template <typename Type>
+  void read(Type& data) {
+    static_assert(std::is_trivially_copyable_v<Type>, "ASSERT: type can't be copied from the wire");
+    if constexpr (std::is_arithmetic_v<Type> || std::is_enum_v<Type>)
+    {
+      if constexpr (sizeof(Type) <= sizeof(uint32_t))
+      {
+        uint32_t value = read_bits(sizeof(Type) * 8);
+        if constexpr (std::endian::native == std::endian::big)
+          value <<= 32 - sizeof(Type) * 8;
+        memcpy(&data, &value, sizeof(Type));
+      }
+      else
+      {
+        uint64_t value = read_bits(32);
+        value |= static_cast<uint64_t>(read_bits(32)) << 32;
+        data = std::bit_cast<Type>(value);
+      }
+    }
+    else
+    {
+      auto* bytes = reinterpret_cast<uint8_t*>(&data);
+      for (size_t i = 0; i < sizeof(Type); ++i)
+        bytes[i] = static_cast<uint8_t>(read_bits(8));
+    }
+  }
+
+  // writer: pushes the partially filled scratch word out and pads to a byte boundary,
+  // must be called before the buffer is sent
+  void flush() {
+    while (scratch_bits_ > 0)
+    {
+      data_ptr_[byte_offset_++] = static_cast<uint8_t>(scratch_);
+      scratch_ >>= 8;
+      scratch_bits_ = scratch_bits_ > 8 ? scratch_bits_ - 8 : 0;
+    }
+    bits_processed_ = byte_offset_ * 8;
+  }
+
+  uint32_t bits_processed() const { return bits_processed_; }
+  uint32_t bytes_processed() const { return bits_to_bytes(bits_processed_); }
+  // set once a read or write went past the end of the buffer, all further accesses are no-ops
+  bool overflow() const { return overflow_; }
+
+private:
+  static uint32_t low_mask(uint32_t num_bits) {
+    return num_bits >= 32 ? 0xffffffff : (1u << num_bits) - 1;
+  }
+
+  bool reserve_bits(uint32_t num_bits) {
+    if (overflow_ || bits_processed_ + num_bits > size_bits_)
+    {
+      overflow_ = true;
+      return false;
+    }
+    bits_processed_ += num_bits;
+    return true;
+  }
+
+  uint8_t* data_ptr_;
+  uint32_t size_bits_;
+  uint32_t byte_offset_ = 0;
+  uint32_t bits_processed_ = 0;
+  uint64_t scratch_ = 0;
+  uint32_t scratch_bits_ = 0;
+  bool overflow_ = false;
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 32-bit generational handle: low 20 bits are the slot index (what goes to the wire as eid),
+// high 12 bits are the generation of the slot, bumped every time the slot is freed
+typedef uint32_t EntityHandle;
+
+constexpr uint32_t entity_index_bits = 20;
+constexpr uint32_t entity_index_mask = (1u << entity_index_bits) - 1;
+constexpr uint32_t entity_generation_mask = (1u << (32 - entity_index_bits)) - 1;
+constexpr EntityHandle invalid_handle = 0xffffffff;
+// eids go out as uint16_t and 0xffff is invalid_entity, a server registry hands out fewer slots than a handle can address
+constexpr uint32_t max_wire_entities = 0xffff;
+
+inline uint32_t handle_index(EntityHandle handle) { return handle & entity_index_mask; }
+inline uint32_t handle_generation(EntityHandle handle) { return handle >> entity_index_bits; }
+inline EntityHandle make_handle(uint32_t index, uint32_t generation)
+{
+  return ((generation & entity_generation_mask) << entity_index_bits) | (index & entity_index_mask);
+}
+
+// Sparse set: values are stored densely (iteration is a plain vector walk),
+// sparse_ maps slot index -> dense position, freed slots are reused through free_list_.
+template <typename T>
+class EntityRegistry {
+public:
+  // create hands out slot indices below max_slots, and invalid_handle once they are all taken
+  explicit EntityRegistry(uint32_t max_slots = entity_index_mask + 1) : maxSlots_(max_slots) {}
+
+  EntityHandle create(const T& value);
+  // clients mirror server ids, so they insert into a given slot instead of allocating one
+  T& emplace_at(uint32_t index, const T& value);
+  bool remove(EntityHandle handle);
+  bool remove_at(uint32_t index);
+
+  T* get(EntityHandle handle);
+  T* find(uint32_t index);
+  const T* find(uint32_t index) const;
+  bool contains(uint32_t index) const { return find(index) != nullptr; }
+  EntityHandle handle_of(uint32_t index) const;
+
+  size_t size() const { return dense_.size(); }
+  bool empty() const { return dense_.empty(); }
+  void reserve(size_t count);
+
+  typename std::vector<T>::iterator begin() { return dense_.begin(); }
+  typename std::vector<T>::iterator end() { return dense_.end(); }
+  typename std::vector<T>::const_iterator begin() const { return dense_.begin(); }
+  typename std::vector<T>::const_iterator end() const { return dense_.end(); }
+  T* data() { return dense_.data(); }
+
+private:
+  static constexpr uint32_t npos = 0xffffffff;
+
+  void grow_to(uint32_t index);
+  void release_slot(uint32_t index);
+
+  std::vector<T> dense_;
+  std::vector<uint32_t> dense_to_index_;
+  std::vector<uint32_t> sparse_;
+  std::vector<uint32_t> generations_;
+  std::vector<uint32_t> free_list_;
+  uint32_t maxSlots_;
+};
+
+///--------------------------------------------------
+
+template <typename T>
+void EntityRegistry<T>::grow_to(uint32_t index)
+{
+  if (index < sparse_.size())
+    return;
+  const uint32_t old_size = static_cast<uint32_t>(sparse_.size());
+  sparse_.resize(index + 1, npos);
+  generations_.resize(index + 1, 0);
+  // slots skipped over by emplace_at stay reusable by create
+  for (uint32_t i = index; i > old_size; --i)
+    free_list_.push_back(i - 1);
+}
+
+template <typename T>
+void EntityRegistry<T>::reserve(size_t count)
+{
+  dense_.reserve(count);
+  dense_to_index_.reserve(count);
+  sparse_.reserve(count);
+  generations_.reserve(count);
+}
+
+template <typename T>
+EntityHandle EntityRegistry<T>::create(const T& value)
+{
+  uint32_t index;
+  do
+  {
+    if (free_list_.empty())
+    {
+      index = static_cast<uint32_t>(sparse_.size());
+      if (index >= maxSlots_)
+        return invalid_handle;
+      sparse_.push_back(npos);
+      generations_.push_back(0);
+      break;
+    }
+    index = free_list_.back();
+    free_list_.pop_back();
+  } while (sparse_[index] != npos); // slot may have been taken by emplace_at meanwhile
+
+  sparse_[index] = static_cast<uint32_t>(dense_.size());
+  dense_.push_back(value);
+  dense_to_index_.push_back(index);
+  return make_handle(index, generations_[index]);
+}
+
+template <typename T>
+T& EntityRegistry<T>::emplace_at(uint32_t index, const T& value)
+{
+  grow_to(index);
+  if (sparse_[index] != npos)
+    return dense_[sparse_[index]] = value;
+
+  sparse_[index] = static_cast<uint32_t>(dense_.size());
+  dense_.push_back(value);
+  dense_to_index_.push_back(index);
+  return dense_.back();
+}
+
+template <typename T>
+void EntityRegistry<T>::release_slot(uint32_t index)
+{
+  const uint32_t pos = sparse_[index];
+  const uint32_t last = static_cast<uint32_t>(dense_.size()) - 1;
+  if (pos != last)
+  {
+    dense_[pos] = std::move(dense_[last]);
+    dense_to_index_[pos] = dense_to_index_[last];
+    sparse_[dense_to_index_[pos]] = pos;
+  }
+  dense_.pop_back();
+  dense_to_index_.pop_back();
+
+  sparse_[index] = npos;
+  generations_[index] = (generations_[index] + 1) & entity_generation_mask;
+  free_list_.push_back(index);
+}
+
+template <typename T>
+bool EntityRegistry<T>::remove(EntityHandle handle)
+{
+  if (get(handle) == nullptr)
+    return false;
+  release_slot(handle_index(handle));
+  return true;
+}
+
+template <typename T>
+bool EntityRegistry<T>::remove_at(uint32_t index)
+{
+  if (find(index) == nullptr)
+    return false;
+  release_slot(index);
+  return true;
+}
+
+template <typename T>
+T* EntityRegistry<T>::get(EntityHandle handle)
+{
+  const uint32_t index = handle_index(handle);
+  if (handle == invalid_handle || index >= sparse_.size() || generations_[index] != handle_generation(handle))
+    return nullptr;
+  return find(index);
+}
+
+template <typename T>
+T* EntityRegistry<T>::find(uint32_t index)
+{
+  if (index >= sparse_.size() || sparse_[index] == npos)
+    return nullptr;
+  return &dense_[sparse_[index]];
+}
+
+template <typename T>
+const T* EntityRegistry<T>::find(uint32_t index) const
+{
+  if (index >= sparse_.size() || sparse_[index] == npos)
+    return nullptr;
+  return &dense_[sparse_[index]];
+}
+
+template <typename T>
+EntityHandle EntityRegistry<T>::handle_of(uint32_t index) const
+{
+  if (find(index) == nullptr)
+    return invalid_handle;
+  return make_handle(index, generations_[index]);
+}
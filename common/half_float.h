@@ -0,0 +1,124 @@
+#pragma once
+
+#include "bitstream.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define HALF_FLOAT_F16C 1
+#endif
+
+// IEEE 754 binary16: 1 sign, 5 exponent and 10 mantissa bits. Good for values whose range isn't
+// known in advance (sizes, velocities), 3 significant digits anywhere in +-65504 for 16 bits on the
+// wire. Rounds to nearest even, like F16C does, so both paths give the same bits.
+
+namespace half_float_detail
+{
+  inline uint16_t float_to_half_portable(float value)
+  {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    uint32_t half = 0;
+    if (bits >= 0x47800000) // 65536 and up, inf and nan
+      half = bits > 0x7f800000 ? 0x7e00 | ((bits >> 13) & 0x3ff) : 0x7c00; // nan stays quiet nan
+    else if (bits < 0x38800000) // subnormal half or zero
+    {
+      // adding 0.5 lines the mantissa bits up at the bottom, the FPU does the rounding
+      constexpr uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+      half = std::bit_cast<uint32_t>(std::bit_cast<float>(bits) + std::bit_cast<float>(denormMagic)) - denormMagic;
+    }
+    else
+    {
+      const uint32_t mantOdd = (bits >> 13) & 1;
+      bits += ((15u - 127u) << 23) + 0xfff + mantOdd; // rebias, round half to even
+      half = bits >> 13; // overflows into inf on its own
+    }
+    return static_cast<uint16_t>(half | sign);
+  }
+
+  inline float half_to_float_portable(uint16_t half)
+  {
+    constexpr uint32_t shiftedExp = 0x7c00 << 13;
+    uint32_t bits = (half & 0x7fffu) << 13;
+    const uint32_t exp = bits & shiftedExp;
+    bits += (127 - 15) << 23;
+    if (exp == shiftedExp) // inf and nan, a signalling nan comes back quiet
+    {
+      bits += (128 - 16) << 23;
+      if (bits & 0x7fffff)
+        bits |= 0x400000;
+    }
+    else if (exp == 0) // zero and subnormals, renormalise
+    {
+      bits += 1 << 23;
+      bits = std::bit_cast<uint32_t>(std::bit_cast<float>(bits) - std::bit_cast<float>(113u << 23));
+    }
+    return std::bit_cast<float>(bits | static_cast<uint32_t>(half & 0x8000) << 16);
+  }
+}
+
+inline uint16_t float_to_half(float value)
+{
+#if defined(HALF_FLOAT_F16C)
+  return static_cast<uint16_t>(_mm_cvtsi128_si32(_mm_cvtps_ph(_mm_set_ss(value), _MM_FROUND_TO_NEAREST_INT)));
+#else
+  return half_float_detail::float_to_half_portable(value);
+#endif
+}
+
+inline float half_to_float(uint16_t half)
+{
+#if defined(HALF_FLOAT_F16C)
+  return _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(half)));
+#else
+  return half_float_detail::half_to_float_portable(half);
+#endif
+}
+
+// SoA batch conversions, 4 values at a time with F16C
+inline void floats_to_halves(const float* in, size_t count, uint16_t* out)
+{
+  size_t i = 0;
+#if defined(HALF_FLOAT_F16C)
+  const size_t simdCount = count & ~size_t(3);
+  for (; i < simdCount; i += 4)
+  {
+    const __m128i halves = _mm_cvtps_ph(_mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), halves);
+  }
+#endif
+  for (; i < count; ++i)
+    out[i] = float_to_half(in[i]);
+}
+
+inline void halves_to_floats(const uint16_t* in, size_t count, float* out)
+{
+  size_t i = 0;
+#if defined(HALF_FLOAT_F16C)
+  const size_t simdCount = count & ~size_t(3);
+  for (; i < simdCount; i += 4)
+  {
+    const __m128i halves = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_ps(out + i, _mm_cvtph_ps(halves));
+  }
+#endif
+  for (; i < count; ++i)
+    out[i] = half_to_float(in[i]);
+}
+
+// MessageSchema field: a float on the wire as 16 bits, no range to configure
+struct HalfField
+{
+  using value_type = float;
+  static constexpr uint32_t num_bits = 16;
+  static constexpr bool is_raw = false;
+
+  static uint32_t to_bits(const float& value) { return float_to_half(value); }
+  static float from_bits(uint32_t bits) { return half_to_float(static_cast<uint16_t>(bits)); }
+
+  static void write(Bitstream& bs, const float& value) { bs.write_bits(to_bits(value), num_bits); }
+  static void read(Bitstream& bs, float& value) { value = from_bits(bs.read_bits(num_bits)); }
+};
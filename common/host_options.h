@@ -0,0 +1,47 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Command line switches shared by all clients and servers
+
+inline bool has_option(int argc, const char **argv, const char *option)
+{
+  for (int i = 1; i < argc; ++i)
+    if (strcmp(argv[i], option) == 0)
+      return true;
+  return false;
+}
+
+// value of "--option N", 0 included; default_value when it's missing or N isn't a whole uint32_t
+inline uint32_t option_value(int argc, const char **argv, const char *option, uint32_t default_value)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], option) == 0)
+    {
+      const char *text = argv[i + 1];
+      char *end = nullptr;
+      errno = 0;
+      const long long value = strtoll(text, &end, 10);
+      if (end == text || *end != '\0' || errno == ERANGE || value < 0 || value > UINT32_MAX)
+        return default_value;
+      return static_cast<uint32_t>(value);
+    }
+  return default_value;
+}
+
+// --compress: ENet's built-in range coder on every outgoing datagram. A host drops compressed
+// datagrams unless it has a compressor too, so the server and its clients need the same switch.
+inline void apply_host_options(ENetHost *host, int argc, const char **argv)
+{
+  if (!has_option(argc, argv, "--compress"))
+    return;
+  if (enet_host_compress_with_range_coder(host) != 0)
+    printf("Cannot enable range coder compression\n");
+  else
+    printf("Range coder compression enabled\n");
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work-stealing job system. Every thread, the caller included, has its own deque of jobs: the owner
+// pushes and pops at the back (newest first, still warm in its cache), an idle thread steals from the
+// front of someone else's. parallel_for cuts a range into chunks of a fixed grain, so which entity
+// lands in which chunk doesn't depend on the thread count: a pass where every entity only writes
+// itself gives the same bits on 1 thread or 32.
+//
+// The deques are mutex guarded. A parallel_for queues a few dozen chunks, not millions of tiny jobs,
+// and at that count the lock is never what the threads wait on.
+//
+//   JobSystem jobs(0); // one thread per core
+//   jobs.parallel_for(entities.size(), 1024, [&](uint32_t begin, uint32_t end) {
+//     for (uint32_t i = begin; i < end; ++i)
+//       simulate_entity(entities.data()[i], dt);
+//   });
+
+class JobSystem {
+public:
+  // num_threads counts the calling thread, 0 is one per core. The default of 1 runs every parallel_for
+  // inline on the caller, the plain serial loop.
+  explicit JobSystem(uint32_t num_threads = 1) {
+    if (num_threads == 0)
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    queues_ = std::vector<Queue>(num_threads);
+    for (uint32_t i = 1; i < num_threads; ++i)
+      workers_.emplace_back([this, i] { worker(i); });
+  }
+
+  ~JobSystem() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex_);
+      stop_ = true;
+    }
+    sleepCv_.notify_all();
+    for (std::thread &worker : workers_)
+      worker.join();
+  }
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  uint32_t thread_count() const { return static_cast<uint32_t>(queues_.size()); }
+
+  // fn(begin, end) over [0, count) in chunks of grain, returns once all of them are done.
+  // The calling thread runs chunks too. Can be called from inside a job.
+  template <typename Fn>
+  void parallel_for(uint32_t count, uint32_t grain, Fn &&fn) {
+    grain = std::max(grain, 1u);
+    const uint32_t chunks = (count + grain - 1) / grain;
+    if (chunks <= 1 || thread_count() == 1)
+    {
+      for (uint32_t begin = 0; begin < count; begin += grain)
+        fn(begin, std::min(count, begin + grain));
+      return;
+    }
+
+    typedef std::remove_reference_t<Fn> Body;
+    const JobFn run = [](void *context, uint32_t begin, uint32_t end) { (*static_cast<Body *>(context))(begin, end); };
+    void *context = const_cast<void *>(static_cast<const void *>(&fn));
+    std::atomic<uint32_t> pending{chunks};
+
+    const uint32_t self = current_queue();
+    {
+      // last chunk first, the owner pops from the back and starts at the front of the range
+      std::lock_guard<std::mutex> lock(queues_[self].mutex);
+      for (uint32_t c = chunks; c-- > 0;)
+        queues_[self].jobs.push_back({run, context, c * grain, std::min(count, (c + 1) * grain), &pending});
+    }
+    queued_.fetch_add(chunks, std::memory_order_release);
+    {
+      // a worker between its last look at queued_ and going to sleep is asleep once we get the lock
+      std::lock_guard<std::mutex> lock(sleepMutex_);
+    }
+    sleepCv_.notify_all();
+
+    while (pending.load(std::memory_order_acquire) > 0)
+      if (!run_one(self))
+        std::this_thread::yield();
+  }
+
+private:
+  typedef void (*JobFn)(void *context, uint32_t begin, uint32_t end);
+
+  struct Job
+  {
+    JobFn run;
+    void *context;
+    uint32_t begin;
+    uint32_t end;
+    std::atomic<uint32_t> *pending;
+  };
+
+  struct alignas(64) Queue
+  {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  // worker threads have their own queue, everyone else shares the first one
+  uint32_t current_queue() const {
+    return workerOwner == this ? workerIndex : 0;
+  }
+
+  bool take(uint32_t self, Job &job) {
+    {
+      std::lock_guard<std::mutex> lock(queues_[self].mutex);
+      if (!queues_[self].jobs.empty())
+      {
+        job = queues_[self].jobs.back();
+        queues_[self].jobs.pop_back();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    for (uint32_t i = 1; i < thread_count(); ++i)
+    {
+      Queue &victim = queues_[(self + i) % thread_count()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty())
+      {
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool run_one(uint32_t self) {
+    Job job;
+    if (!take(self, job))
+      return false;
+    job.run(job.context, job.begin, job.end);
+    // the parallel_for may return right after this, job.pending is gone then
+    job.pending->fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+  }
+
+  void worker(uint32_t self) {
+    workerOwner = this;
+    workerIndex = self;
+    while (true)
+    {
+      if (run_one(self))
+        continue;
+      std::unique_lock<std::mutex> lock(sleepMutex_);
+      sleepCv_.wait(lock, [this] { return stop_ || queued_.load(std::memory_order_acquire) > 0; });
+      if (stop_)
+        return;
+    }
+  }
+
+  std::vector<Queue> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<uint32_t> queued_{0}; // jobs sitting in any of the deques
+  std::mutex sleepMutex_;
+  std::condition_variable sleepCv_;
+  bool stop_ = false;
+
+  static inline thread_local const JobSystem *workerOwner = nullptr;
+  static inline thread_local uint32_t workerIndex = 0;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "bitstream.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+
+// Compile-time message layout: a message is an 8-bit type followed by a list of fields,
+// every field knows its exact bit width, so packet sizes and field offsets are constants.
+//
+//   using SnapshotMsg = MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint32_t, 21>>;
+//   ENetPacket *packet = enet_packet_create(nullptr, SnapshotMsg::num_bytes, flags);
+//   SnapshotMsg::write(packet->data, eid, pos);
+//   ...
+//   MessageView<SnapshotMsg> view(packet->data, packet->dataLength);
+//   uint16_t eid = view.get<0>();
+
+// Integral, enum, bool or float value of at most 32 bits, stored in num_bits on the wire
+template <typename T, uint32_t NumBits = sizeof(T) * 8>
+struct Field
+{
+  static_assert(NumBits > 0 && NumBits <= 32, "ASSERT: field must fit into 32 bits");
+  static_assert(NumBits <= sizeof(T) * 8, "ASSERT: type is too small");
+  static_assert(!std::is_floating_point_v<T> || NumBits == 32, "ASSERT: floats are stored whole, quantise them first");
+
+  using value_type = T;
+  static constexpr uint32_t num_bits = NumBits;
+  static constexpr bool is_raw = false;
+
+  static uint32_t to_bits(const T& value)
+  {
+    if constexpr (std::is_floating_point_v<T>)
+      return std::bit_cast<uint32_t>(value);
+    else
+      return static_cast<uint32_t>(value);
+  }
+
+  static T from_bits(uint32_t bits)
+  {
+    if constexpr (std::is_floating_point_v<T>)
+      return std::bit_cast<T>(bits);
+    else
+      return static_cast<T>(bits);
+  }
+
+  static void write(Bitstream& bs, const T& value) { bs.write_bits(to_bits(value), NumBits); }
+  static void read(Bitstream& bs, T& value) { value = from_bits(bs.read_bits(NumBits)); }
+};
+
+// Trivially copyable struct copied to the wire as it is in memory
+template <typename T>
+struct RawField
+{
+  static_assert(std::is_trivially_copyable_v<T>, "ASSERT: type can't be copied to the wire");
+
+  using value_type = T;
+  static constexpr uint32_t num_bits = sizeof(T) * 8;
+  static constexpr bool is_raw = true;
+
+  static void write(Bitstream& bs, const T& value) { bs.write(value); }
+  static void read(Bitstream& bs, T& value) { bs.read(value); }
+};
+
+template <auto Type, typename... Fields>
+struct MessageSchema
+{
+  static constexpr uint8_t type = static_cast<uint8_t>(Type);
+  static constexpr uint32_t header_bits = 8;
+  static constexpr uint32_t num_bits = header_bits + (Fields::num_bits + ... + 0);
+  static constexpr size_t num_bytes = bits_to_bytes(num_bits);
+  static constexpr size_t num_fields = sizeof...(Fields);
+
+  template <size_t I>
+  using field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+  template <size_t I>
+  static constexpr uint32_t bit_offset()
+  {
+    constexpr uint32_t widths[] = {Fields::num_bits..., 0};
+    uint32_t offset = header_bits;
+    for (size_t i = 0; i < I; ++i)
+      offset += widths[i];
+    return offset;
+  }
+
+  static void write(Bitstream& bs, const typename Fields::value_type&... values)
+  {
+    bs.write_bits(type, header_bits);
+    (Fields::write(bs, values), ...);
+  }
+
+  // data must hold at least num_bytes
+  static void write(uint8_t* data, const typename Fields::value_type&... values)
+  {
+    Bitstream bs(data, num_bytes);
+    write(bs, values...);
+    bs.flush();
+  }
+
+  // leaves bs right after the last field, so the message can go on with a body of its own
+  static bool read(Bitstream& bs, typename Fields::value_type&... values)
+  {
+    const bool typeMatches = bs.read_bits(header_bits) == type;
+    (Fields::read(bs, values), ...);
+    return typeMatches && !bs.overflow();
+  }
+
+  static bool read(const uint8_t* data, size_t size, typename Fields::value_type&... values)
+  {
+    if (size < num_bytes)
+      return false;
+    Bitstream bs(const_cast<uint8_t*>(data), size);
+    return read(bs, values...);
+  }
+};
+
+// Zero-copy reader: every field is extracted straight from the packet at its constant offset,
+// nothing is decoded until asked for
+template <typename Schema>
+class MessageView {
+public:
+  MessageView(const uint8_t* data, size_t size)
+    : data_ptr_(data),
+      size_(size) {
+  }
+
+  bool valid() const { return size_ >= Schema::num_bytes && data_ptr_[0] == Schema::type; }
+
+  template <size_t I>
+  typename Schema::template field<I>::value_type get() const {
+    using F = typename Schema::template field<I>;
+    constexpr uint32_t offset = Schema::template bit_offset<I>();
+    if constexpr (F::is_raw)
+    {
+      static_assert(offset % 8 == 0, "ASSERT: raw fields must be byte aligned");
+      typename F::value_type value;
+      memcpy(&value, data_ptr_ + offset / 8, sizeof(value));
+      return value;
+    }
+    else
+      return F::from_bits(extract_bits(offset, F::num_bits));
+  }
+
+private:
+  uint32_t extract_bits(uint32_t bit_offset, uint32_t num_bits) const {
+    const uint32_t first_byte = bit_offset / 8;
+    uint64_t window = 0;
+    if (first_byte + sizeof(uint64_t) <= size_)
+    {
+      memcpy(&window, data_ptr_ + first_byte, sizeof(uint64_t));
+      window = from_wire_endian(window);
+    }
+    else
+    {
+      for (uint32_t i = 0; first_byte + i < size_ && i < sizeof(uint64_t); ++i)
+        window |= static_cast<uint64_t>(data_ptr_[first_byte + i]) << (i * 8);
+    }
+    window >>= bit_offset % 8;
+    return static_cast<uint32_t>(window & (num_bits >= 32 ? 0xffffffffull : (1ull << num_bits) - 1));
+  }
+
+  const uint8_t* data_ptr_;
+  size_t size_;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+
+// Every protocol.cpp sends through net_send. By default that's enet_peer_send right away; on a server
+// whose ENetHost belongs to a network thread (net_thread.h) the simulation thread routes it into that
+// thread's outbound queue instead, ENet isn't thread safe and only the owner may touch the host.
+
+struct NetSendRoute
+{
+  void *context = nullptr;
+  void (*send)(void *context, ENetPeer *peer, uint8_t channel, ENetPacket *packet) = nullptr;
+};
+
+// per thread: only the simulation thread is routed
+inline thread_local NetSendRoute netSendRoute;
+
+inline void net_send(ENetPeer *peer, uint8_t channel, ENetPacket *packet)
+{
+  if (netSendRoute.send)
+    netSendRoute.send(netSendRoute.context, peer, channel, packet);
+  else
+    enet_peer_send(peer, channel, packet);
+}
+
+// a routed send is flushed by the network thread as soon as it has been handed to ENet
+inline void net_flush(ENetHost *host)
+{
+  if (!netSendRoute.send)
+    enet_host_flush(host);
+}
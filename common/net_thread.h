@@ -0,0 +1,262 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "net_send.h"
+#include "spsc_queue.h"
+#include "tick_scheduler.h"
+
+// Network I/O on its own thread. The network thread owns the ENetHost: it hands ENet everything the
+// simulation queued for sending and services the host, receives go the other way. The simulation thread
+// owns the world and never touches the host, a slow tick no longer holds up receiving and acks, and
+// a burst of packets doesn't delay the tick.
+//
+//   NetThread net(server);
+//   net.start();                // routes this thread's net_send into the outbound queue
+//   scheduler.wait([&](uint32_t timeout_ms) { net.service(timeout_ms, handle_event); });
+//
+// By the time the simulation handles an event ENet may have reset its peer and handed the slot to the
+// next client, so what the handlers read of the peer is copied into the event here. A packet the
+// simulation queued for a peer carries the connection it was meant for and is dropped when the
+// slot belongs to another one by the time it's sent.
+
+const uint32_t NET_POLL_MS = 1; // how long a queued send may wait for the network thread to wake up
+const size_t NET_INBOUND_CAPACITY = 4096;  // events
+const size_t NET_OUTBOUND_CAPACITY = 16384; // packets, a tick of snapshots for every peer
+
+struct NetEvent
+{
+  ENetEvent event;
+  ENetAddress address;   // event.peer's when it was received, don't read the peer's own
+  enet_uint32 connectID; // event.peer's connection
+  int64_t recvNs;        // tick_clock time the network thread got it
+};
+
+// on the thread that owns the host, while the peer still is what the event is about
+inline NetEvent make_net_event(const ENetEvent &event, int64_t recv_ns)
+{
+  return {event, event.peer->address, event.peer->connectID, recv_ns};
+}
+
+struct OutboundPacket
+{
+  ENetPeer *peer;
+  ENetPacket *packet;
+  enet_uint32 connectID; // the connection it's meant for
+  uint8_t channel;
+};
+
+// Receive time to the start of the tick that first simulates with the packet, either threading model
+class InputLatency {
+public:
+  void received(int64_t recv_ns) {
+    if (pending_ == 0 || recv_ns < oldestNs_)
+      oldestNs_ = recv_ns;
+    pendingNs_ += recv_ns;
+    ++pending_;
+  }
+
+  void tick_started(int64_t now_ns) {
+    if (pending_ == 0)
+      return;
+    count_ += pending_;
+    totalNs_ += int64_t(pending_) * now_ns - pendingNs_;
+    if (now_ns - oldestNs_ > maxNs_)
+      maxNs_ = now_ns - oldestNs_;
+    pending_ = 0;
+    pendingNs_ = 0;
+  }
+
+  void print() const {
+    if (count_ > 0)
+      printf("input to simulation: %llu packets, avg %.1f max %.1f us\n", (unsigned long long)count_,
+             totalNs_ * 0.001 / count_, maxNs_ * 0.001);
+  }
+  void reset() { count_ = 0; totalNs_ = 0; maxNs_ = 0; }
+
+private:
+  uint64_t pending_ = 0;
+  int64_t pendingNs_ = 0;
+  int64_t oldestNs_ = 0;
+  uint64_t count_ = 0;
+  int64_t totalNs_ = 0;
+  int64_t maxNs_ = 0;
+};
+
+class NetThread {
+public:
+  explicit NetThread(ENetHost *host) : host_(host), peerConnections_(host->peerCount) {}
+  ~NetThread() { stop(); }
+
+  NetThread(const NetThread &) = delete;
+  NetThread &operator=(const NetThread &) = delete;
+
+  // the calling thread becomes the simulation thread
+  void start() {
+    netSendRoute = {this, &NetThread::route};
+    running_.store(true, std::memory_order_relaxed);
+    thread_ = std::thread([this] { run(); });
+  }
+
+  void stop() {
+    if (!thread_.joinable())
+      return;
+    running_.store(false, std::memory_order_relaxed);
+    thread_.join();
+    netSendRoute = NetSendRoute();
+  }
+
+  // Simulation thread: handles what has arrived. If that was nothing, waits up to timeout_ms for the
+  // network thread to queue something and handles that as soon as it's there, like enet_host_service would.
+  template <typename Handler>
+  void service(uint32_t timeout_ms, Handler &&handle) {
+    if (dispatch(handle) == 0 && timeout_ms > 0)
+    {
+      {
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        wakeCv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return inbound_.size() > 0; });
+      }
+      dispatch(handle);
+    }
+  }
+
+  // Simulation thread, what net_send ends up in. Waits for room rather than drop: it may be reliable.
+  // A peer whose disconnect has been handled gets nothing.
+  void send(ENetPeer *peer, uint8_t channel, ENetPacket *packet) {
+    const PeerConnection &connection = peerConnections_[peer - host_->peers];
+    if (!connection.connected)
+    {
+      enet_packet_destroy(packet);
+      ++droppedBySimulation_;
+      return;
+    }
+    const OutboundPacket out = {peer, packet, connection.connectID, channel};
+    if (outbound_.push(out))
+      return;
+    outboundStalls_.fetch_add(1, std::memory_order_relaxed);
+    while (!outbound_.push(out))
+      std::this_thread::yield();
+  }
+
+  void print_metrics() const {
+    printf("network thread: %llu received, %llu sent, stalled on full queues %llu in %llu out, "
+           "dropped for gone peers %llu\n",
+           (unsigned long long)received_.load(std::memory_order_relaxed),
+           (unsigned long long)sent_.load(std::memory_order_relaxed),
+           (unsigned long long)inboundStalls_.load(std::memory_order_relaxed),
+           (unsigned long long)outboundStalls_.load(std::memory_order_relaxed),
+           (unsigned long long)(droppedBySimulation_ + dropped_.load(std::memory_order_relaxed)));
+  }
+
+private:
+  static void route(void *context, ENetPeer *peer, uint8_t channel, ENetPacket *packet) {
+    static_cast<NetThread *>(context)->send(peer, channel, packet);
+  }
+
+  template <typename Handler>
+  uint32_t dispatch(Handler &handle) {
+    uint32_t handled = 0;
+    NetEvent event;
+    while (inbound_.pop(event))
+    {
+      track_connection(event);
+      handle(event);
+      ++handled;
+    }
+    return handled;
+  }
+
+  // simulation thread: which connection a peer's packets are for, as far as the handled events go
+  void track_connection(const NetEvent &event) {
+    PeerConnection &connection = peerConnections_[event.event.peer - host_->peers];
+    if (event.event.type == ENET_EVENT_TYPE_CONNECT)
+      connection = {event.connectID, true};
+    else if (event.event.type == ENET_EVENT_TYPE_DISCONNECT)
+      connection.connected = false;
+  }
+
+  void run() {
+    ENetEvent event;
+    while (running_.load(std::memory_order_relaxed))
+    {
+      uint64_t sent = 0;
+      OutboundPacket out;
+      while (outbound_.pop(out))
+      {
+        // queued before the simulation saw the disconnect, the slot may be another client's already
+        if (out.peer->connectID != out.connectID)
+        {
+          enet_packet_destroy(out.packet);
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        // a peer gone meanwhile refuses it, the packet is still ours then
+        if (enet_peer_send(out.peer, out.channel, out.packet) < 0 && out.packet->referenceCount == 0)
+          enet_packet_destroy(out.packet);
+        ++sent;
+      }
+      if (sent > 0)
+      {
+        enet_host_flush(host_);
+        sent_.fetch_add(sent, std::memory_order_relaxed);
+      }
+
+      int serviced = enet_host_service(host_, &event, NET_POLL_MS);
+      if (serviced <= 0)
+        continue;
+      while (serviced > 0)
+      {
+        push_inbound(make_net_event(event, tick_clock::now_ns()));
+        serviced = enet_host_service(host_, &event, 0);
+      }
+      wake_simulation();
+    }
+  }
+
+  // once per burst of events; taking the lock orders the pushes before a waiting service's check
+  void wake_simulation() {
+    {
+      std::lock_guard<std::mutex> lock(wakeMutex_);
+    }
+    wakeCv_.notify_one();
+  }
+
+  // the simulation is behind: wait for it, ENet keeps the rest in its own queues meanwhile
+  void push_inbound(const NetEvent &event) {
+    received_.fetch_add(1, std::memory_order_relaxed);
+    if (inbound_.push(event))
+      return;
+    inboundStalls_.fetch_add(1, std::memory_order_relaxed);
+    wake_simulation();
+    while (!inbound_.push(event) && running_.load(std::memory_order_relaxed))
+      std::this_thread::yield();
+  }
+
+  struct PeerConnection
+  {
+    enet_uint32 connectID = 0;
+    bool connected = false;
+  };
+
+  ENetHost *host_;
+  std::vector<PeerConnection> peerConnections_; // simulation thread only, by peer index
+  uint64_t droppedBySimulation_ = 0;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+  std::mutex wakeMutex_;
+  std::condition_variable wakeCv_;
+  SpscQueue<NetEvent, NET_INBOUND_CAPACITY> inbound_;
+  SpscQueue<OutboundPacket, NET_OUTBOUND_CAPACITY> outbound_;
+  std::atomic<uint64_t> received_{0};
+  std::atomic<uint64_t> sent_{0};
+  std::atomic<uint64_t> inboundStalls_{0};
+  std::atomic<uint64_t> outboundStalls_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "net_send.h"
+
+// Per-peer packets are built on job threads (job_system.h), but only the thread that owns sending may
+// net_send: with a network thread it's the one producer of the outbound queue (net_thread.h).
+// Each peer gets a slot; while a PacketCapture lives, net_send on its thread appends to that slot, and
+// send_all hands everything over from the sending thread in slot order, the order a serial loop over
+// the peers would have sent in. Slots keep their capacity, a steady tick doesn't allocate here.
+// On a single-threaded JobSystem, the servers' default, peers are encoded inline and the batch
+// only defers the sends.
+//
+//   batch.resize(host->peerCount);
+//   jobs.parallel_for(host->peerCount, 16, [&](uint32_t begin, uint32_t end) {
+//     for (uint32_t i = begin; i < end; ++i)
+//     {
+//       PacketCapture capture(batch, i);
+//       send_snapshot(&host->peers[i], ...);
+//     }
+//   });
+//   batch.send_all();
+
+struct PendingPacket
+{
+  ENetPeer *peer;
+  ENetPacket *packet;
+  uint8_t channel;
+};
+
+class PacketBatch {
+public:
+  // not while a capture is running, the slots would move
+  void resize(size_t slots) { slots_.resize(slots); }
+  size_t size() const { return slots_.size(); }
+
+  std::vector<PendingPacket> &slot(size_t index) { return slots_[index]; }
+
+  void send_all() {
+    for (std::vector<PendingPacket> &slot : slots_)
+    {
+      for (const PendingPacket &pending : slot)
+        net_send(pending.peer, pending.channel, pending.packet);
+      slot.clear();
+    }
+  }
+
+private:
+  std::vector<std::vector<PendingPacket>> slots_;
+};
+
+// routes net_send on the current thread into one slot of a batch for its lifetime
+class PacketCapture {
+public:
+  PacketCapture(PacketBatch &batch, size_t slot) : saved_(netSendRoute) {
+    netSendRoute = {&batch.slot(slot), &PacketCapture::append};
+  }
+  ~PacketCapture() { netSendRoute = saved_; }
+
+  PacketCapture(const PacketCapture &) = delete;
+  PacketCapture &operator=(const PacketCapture &) = delete;
+
+private:
+  static void append(void *context, ENetPeer *peer, uint8_t channel, ENetPacket *packet) {
+    static_cast<std::vector<PendingPacket> *>(context)->push_back({peer, packet, channel});
+  }
+
+  NetSendRoute saved_;
+};
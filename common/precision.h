@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+// Per (viewer, entity) snapshot precision. Every level is the full-precision code with a few
+// low bits dropped, so the server quantises an entity once and only shifts per receiver.
+// The level travels in a 2-bit tag right after the eid.
+//
+//   level    x/y/ori bits   snapshot size    error at 10 px per world unit
+//   FULL     11/10/8        9 bytes          < 0.2 px, 1.4 deg
+//   MEDIUM   8/7/6          8 bytes          < 0.8 px, 2.8 deg
+//   LOW      6/4/3          7 bytes          < 6.3 px, 22 deg
+
+enum PrecisionLevel : uint8_t
+{
+  E_PRECISION_FULL = 0,
+  E_PRECISION_MEDIUM,
+  E_PRECISION_LOW,
+  E_PRECISION_LEVEL_COUNT
+};
+
+constexpr uint32_t precision_level_bits = 2;
+static_assert(E_PRECISION_LEVEL_COUNT <= (1 << precision_level_bits));
+
+// low bits removed from the full-precision x, y and ori codes
+struct PrecisionDrop
+{
+  uint32_t x;
+  uint32_t y;
+  uint32_t ori;
+};
+
+constexpr PrecisionDrop precision_drop[E_PRECISION_LEVEL_COUNT] = {
+  {0, 0, 0},
+  {3, 3, 2},
+  {5, 6, 5}
+};
+
+inline uint32_t reduce_precision(uint32_t code, uint32_t dropped_bits)
+{
+  return code >> dropped_bits;
+}
+
+// back to a full-precision code in the middle of the dropped interval, halves the error of plain zero filling
+inline uint32_t restore_precision(uint32_t code, uint32_t dropped_bits)
+{
+  return dropped_bits == 0 ? code : (code << dropped_bits) | (1u << (dropped_bits - 1));
+}
+
+// Distances are measured from the entity the receiving peer controls, the camera is not sent to the server
+struct PrecisionPolicy
+{
+  float fullRadius = 5.f;
+  float mediumRadius = 12.f;
+};
+
+inline PrecisionLevel select_precision(const PrecisionPolicy &policy, float viewer_x, float viewer_y, float x, float y)
+{
+  const float dx = x - viewer_x;
+  const float dy = y - viewer_y;
+  const float distSq = dx * dx + dy * dy;
+  if (distSq <= policy.fullRadius * policy.fullRadius)
+    return E_PRECISION_FULL;
+  if (distSq <= policy.mediumRadius * policy.mediumRadius)
+    return E_PRECISION_MEDIUM;
+  return E_PRECISION_LOW;
+}
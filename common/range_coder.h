@@ -0,0 +1,231 @@
+#pragma once
+
+#include "bitstream.h"
+#include "varint.h"
+#include <bit>
+#include <cstdint>
+
+// Adaptive binary range coder (LZMA flavour) on top of a Bitstream: every coded bit has a
+// probability model that moves towards the bits it sees, so predictable fields shrink far below
+// their fixed width. Coded bytes go through write_bits/read_bits, so a message can start with plain
+// fields and continue with a coded body in the same stream.
+//
+// Encoder and decoder stay in sync only while they update the same models with the same bits,
+// models are plain values and can be copied to snapshot a coding state.
+
+constexpr uint32_t range_model_bits = 11;
+constexpr uint32_t range_model_total = 1u << range_model_bits;
+// adaptation speed, larger is slower and more precise
+constexpr uint32_t range_move_bits = 5;
+constexpr uint32_t range_top = 1u << 24;
+
+struct BitModel
+{
+  uint16_t prob = range_model_total / 2; // probability of 0, in 1/2048
+
+  void update(uint32_t bit)
+  {
+    if (bit == 0)
+      prob += static_cast<uint16_t>((range_model_total - prob) >> range_move_bits);
+    else
+      prob -= static_cast<uint16_t>(prob >> range_move_bits);
+  }
+};
+
+class RangeEncoder {
+public:
+  explicit RangeEncoder(Bitstream& bs)
+    : bs_(bs) {
+  }
+
+  void encode_bit(BitModel& model, uint32_t bit) {
+    const uint32_t bound = (range_ >> range_model_bits) * model.prob;
+    if (bit == 0)
+      range_ = bound;
+    else
+    {
+      low_ += bound;
+      range_ -= bound;
+    }
+    model.update(bit);
+    normalize();
+  }
+
+  // equiprobable bits, no model
+  void encode_direct(uint32_t value, uint32_t num_bits) {
+    while (num_bits > 0)
+    {
+      --num_bits;
+      range_ >>= 1;
+      if ((value >> num_bits) & 1)
+        low_ += range_;
+      normalize();
+    }
+  }
+
+  // must be called once after the last symbol
+  void flush() {
+    for (int i = 0; i < 5; ++i)
+      shift_low();
+  }
+
+private:
+  void normalize() {
+    while (range_ < range_top)
+    {
+      range_ <<= 8;
+      shift_low();
+    }
+  }
+
+  // a carry may still ripple into bytes already produced, they wait in cache_ until it can't
+  void shift_low() {
+    if (static_cast<uint32_t>(low_) < 0xff000000u || (low_ >> 32) != 0)
+    {
+      const uint8_t carry = static_cast<uint8_t>(low_ >> 32);
+      uint8_t temp = cache_;
+      do
+      {
+        bs_.write_bits(static_cast<uint8_t>(temp + carry), 8);
+        temp = 0xff;
+      } while (--cache_size_ != 0);
+      cache_ = static_cast<uint8_t>(low_ >> 24);
+    }
+    ++cache_size_;
+    low_ = (low_ & 0x00ffffffu) << 8;
+  }
+
+  Bitstream& bs_;
+  uint64_t low_ = 0;
+  uint32_t range_ = 0xffffffffu;
+  uint8_t cache_ = 0;
+  uint64_t cache_size_ = 1;
+};
+
+class RangeDecoder {
+public:
+  explicit RangeDecoder(Bitstream& bs)
+    : bs_(bs) {
+    for (int i = 0; i < 5; ++i)
+      code_ = (code_ << 8) | bs_.read_bits(8);
+  }
+
+  uint32_t decode_bit(BitModel& model) {
+    const uint32_t bound = (range_ >> range_model_bits) * model.prob;
+    uint32_t bit = 0;
+    if (code_ < bound)
+      range_ = bound;
+    else
+    {
+      code_ -= bound;
+      range_ -= bound;
+      bit = 1;
+    }
+    model.update(bit);
+    normalize();
+    return bit;
+  }
+
+  uint32_t decode_direct(uint32_t num_bits) {
+    uint32_t value = 0;
+    while (num_bits > 0)
+    {
+      --num_bits;
+      range_ >>= 1;
+      const uint32_t bit = code_ >= range_ ? 1 : 0;
+      if (bit)
+        code_ -= range_;
+      value = (value << 1) | bit;
+      normalize();
+    }
+    return value;
+  }
+
+  // reading past the end of the packet, the decoded values are garbage
+  bool overflow() const { return bs_.overflow(); }
+
+private:
+  void normalize() {
+    while (range_ < range_top)
+    {
+      range_ <<= 8;
+      code_ = (code_ << 8) | bs_.read_bits(8);
+    }
+  }
+
+  Bitstream& bs_;
+  uint32_t code_ = 0;
+  uint32_t range_ = 0xffffffffu;
+};
+
+///--------------------------------------------------
+/// Binary tree of models for NumBits-wide symbols, every prefix has its own probability
+
+template <uint32_t NumBits>
+struct BitTreeModel
+{
+  BitModel models[1u << NumBits];
+
+  void encode(RangeEncoder& rc, uint32_t symbol)
+  {
+    uint32_t node = 1;
+    for (uint32_t i = NumBits; i > 0; --i)
+    {
+      const uint32_t bit = (symbol >> (i - 1)) & 1;
+      rc.encode_bit(models[node], bit);
+      node = (node << 1) | bit;
+    }
+  }
+
+  uint32_t decode(RangeDecoder& rc)
+  {
+    uint32_t node = 1;
+    for (uint32_t i = 0; i < NumBits; ++i)
+      node = (node << 1) | rc.decode_bit(models[node]);
+    return node - (1u << NumBits);
+  }
+};
+
+///--------------------------------------------------
+/// Unsigned integers of any size: the bit length is coded with an adaptive tree,
+/// the bit right below the leading one with a model per length, the rest as direct bits.
+/// Values the field usually takes cost a fraction of a bit.
+
+struct UintModel
+{
+  BitTreeModel<6> length;
+  BitModel secondBit[33];
+
+  void encode(RangeEncoder& rc, uint32_t value)
+  {
+    const uint32_t len = static_cast<uint32_t>(std::bit_width(value));
+    length.encode(rc, len);
+    if (len < 2)
+      return;
+    rc.encode_bit(secondBit[len], (value >> (len - 2)) & 1);
+    if (len > 2)
+      rc.encode_direct(value, len - 2);
+  }
+
+  uint32_t decode(RangeDecoder& rc)
+  {
+    const uint32_t len = length.decode(rc);
+    if (len > 32)
+      return 0; // malformed input
+    if (len < 2)
+      return len;
+    uint32_t value = 2 | rc.decode_bit(secondBit[len]);
+    if (len > 2)
+      value = (value << (len - 2)) | rc.decode_direct(len - 2);
+    return value;
+  }
+};
+
+// signed deltas, zigzag mapped so that small magnitudes of either sign are cheap
+struct SintModel
+{
+  UintModel magnitude;
+
+  void encode(RangeEncoder& rc, int32_t value) { magnitude.encode(rc, zigzag_encode(value)); }
+  int32_t decode(RangeDecoder& rc) { return zigzag_decode(magnitude.decode(rc)); }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "tick_scheduler.h"
+
+// Many matches in one process. A room is one match: its world, the peers playing in it and its own tick
+// clock; what a world is belongs to the week's room.h. Rooms share nothing but the ENetHost (behind the
+// network thread) and the job system, so all rooms that are due tick at once on the job threads and
+// their packets are sent afterwards, room by room. Every room is on its own absolute grid from when it
+// woke up, so their ticks spread over the period instead of piling up on the same instant. A room
+// without players sleeps: it isn't ticked until someone joins it.
+//
+//   RoomScheduler<Room> scheduler(server_tick_rate);
+//   while (true)
+//   {
+//     const std::vector<Room*> &due = scheduler.wait(rooms, service);
+//     jobs.parallel_for(due.size(), 1, [&](uint32_t begin, uint32_t end) { ...tick_room(*due[i])... });
+//     for (Room *room : due)
+//       room->outbox.send_all();
+//     scheduler.batch_done();
+//   }
+//
+// Room needs: uint32_t id, std::vector<ENetPeer*> peers, RoomClock clock and bool awake() const.
+
+constexpr uint32_t room_max_catch_up_ticks = 5;
+
+struct RoomClock
+{
+  int64_t nextTickNs = 0;
+  uint32_t dueTicks = 0; // to simulate in the current batch
+};
+
+struct RoomMetrics
+{
+  uint64_t batches = 0;        // wake-ups with at least one room due
+  uint64_t roomRuns = 0;       // rooms ticked in some batch
+  uint64_t roomTicks = 0;      // simulated ticks, catch-up included
+  uint64_t droppedTicks = 0;   // behind by more than room_max_catch_up_ticks, never simulated
+  int64_t totalLatenessNs = 0; // room run past its deadline
+  int64_t maxLatenessNs = 0;
+  int64_t totalBatchNs = 0;    // every due room ticked and its packets sent
+  int64_t maxBatchNs = 0;
+};
+
+inline void print_room_metrics(const RoomMetrics &metrics, size_t awake_rooms, size_t rooms)
+{
+  printf("rooms %zu awake of %zu, %llu room ticks (dropped %llu) in %llu batches\n", awake_rooms, rooms,
+         (unsigned long long)metrics.roomTicks, (unsigned long long)metrics.droppedTicks,
+         (unsigned long long)metrics.batches);
+  if (metrics.batches == 0)
+    return;
+  printf("room late by avg %.1f max %.1f us, batch work avg %.1f max %.1f us\n",
+         metrics.totalLatenessNs * 0.001 / metrics.roomRuns, metrics.maxLatenessNs * 0.001,
+         metrics.totalBatchNs * 0.001 / metrics.batches, metrics.maxBatchNs * 0.001);
+}
+
+// fills the awake rooms first so matches pack densely, then wakes a sleeping one, then opens a new one
+template <typename Room>
+Room &room_for_new_player(std::vector<std::unique_ptr<Room>> &rooms, uint32_t room_size)
+{
+  for (const std::unique_ptr<Room> &room : rooms)
+    if (room->awake() && room->peers.size() < room_size)
+      return *room;
+  for (const std::unique_ptr<Room> &room : rooms)
+    if (!room->awake())
+      return *room;
+  rooms.push_back(std::make_unique<Room>());
+  rooms.back()->id = static_cast<uint32_t>(rooms.size() - 1);
+  return *rooms.back();
+}
+
+template <typename Room>
+class RoomScheduler {
+public:
+  explicit RoomScheduler(uint32_t ticks_per_second)
+    : periodNs_(1'000'000'000 / int64_t(ticks_per_second)),
+      dt_(1.f / ticks_per_second) {
+  }
+
+  // a room getting its first player starts its grid now
+  void wake(Room &room) const {
+    room.clock.nextTickNs = tick_clock::now_ns() + periodNs_;
+  }
+
+  // Runs service(timeout_ms) until the first awake room is due, the last ms is a precise sleep as in
+  // TickScheduler. Returns the rooms to tick now, each with clock.dueTicks set.
+  template <typename Service>
+  const std::vector<Room*> &wait(const std::vector<std::unique_ptr<Room>> &rooms, Service &&service) {
+    constexpr int64_t msNs = 1'000'000;
+    int64_t now = tick_clock::now_ns();
+    int64_t deadline = now + periodNs_;
+    for (const std::unique_ptr<Room> &room : rooms)
+      if (room->awake())
+        deadline = std::min(deadline, room->clock.nextTickNs);
+    while (deadline - now > 2 * msNs)
+    {
+      service(static_cast<uint32_t>((deadline - now - msNs) / msNs));
+      now = tick_clock::now_ns();
+    }
+    service(0u);
+    if (now < deadline)
+      tick_clock::sleep_until_ns(deadline);
+
+    batchStartNs_ = tick_clock::now_ns();
+    due_.clear();
+    for (const std::unique_ptr<Room> &room : rooms)
+      if (room->awake() && (room->clock.dueTicks = take_due_ticks(room->clock, batchStartNs_)) > 0)
+        due_.push_back(room.get());
+    return due_;
+  }
+
+  // after the due rooms' packets are sent, for the metrics
+  void batch_done() {
+    if (due_.empty())
+      return;
+    const int64_t work = tick_clock::now_ns() - batchStartNs_;
+    ++metrics_.batches;
+    metrics_.totalBatchNs += work;
+    if (work > metrics_.maxBatchNs)
+      metrics_.maxBatchNs = work;
+  }
+
+  float dt() const { return dt_; }
+  int64_t batch_start_ns() const { return batchStartNs_; }
+  const RoomMetrics &metrics() const { return metrics_; }
+  void reset_metrics() { metrics_ = RoomMetrics(); }
+
+private:
+  // ticks due by now_ns, at most room_max_catch_up_ticks; the grid moves on past the dropped ones too
+  uint32_t take_due_ticks(RoomClock &clock, int64_t now_ns) {
+    if (now_ns < clock.nextTickNs)
+      return 0;
+    const int64_t lateness = now_ns - clock.nextTickNs;
+    uint64_t due = 1 + uint64_t(lateness / periodNs_);
+    clock.nextTickNs += int64_t(due) * periodNs_;
+    if (due > room_max_catch_up_ticks)
+    {
+      metrics_.droppedTicks += due - room_max_catch_up_ticks;
+      due = room_max_catch_up_ticks;
+    }
+
+    ++metrics_.roomRuns;
+    metrics_.roomTicks += due;
+    metrics_.totalLatenessNs += lateness;
+    if (lateness > metrics_.maxLatenessNs)
+      metrics_.maxLatenessNs = lateness;
+    return static_cast<uint32_t>(due);
+  }
+
+  int64_t periodNs_;
+  float dt_;
+  int64_t batchStartNs_ = 0;
+  std::vector<Room*> due_;
+  RoomMetrics metrics_;
+};
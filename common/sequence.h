@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// 16-bit sequence numbers (server ticks, snapshot seqs) wrap around, so they are compared through
+// their signed distance: a is newer than b when it is less than half the range ahead of it.
+// At 100 ticks a second that's 5 minutes either way.
+
+inline int16_t sequence_diff(uint16_t a, uint16_t b)
+{
+  return static_cast<int16_t>(static_cast<uint16_t>(a - b));
+}
+
+inline bool sequence_greater(uint16_t a, uint16_t b) { return sequence_diff(a, b) > 0; }
+inline bool sequence_less(uint16_t a, uint16_t b) { return sequence_diff(a, b) < 0; }
+
+// Last server tick applied to every entity on the client. Snapshots travel unsequenced,
+// one older than what the entity already shows is dropped instead of moving it back.
+// The same tick again is let through, w4 may send an entity twice in one tick after a collision.
+class EntityTickFilter {
+public:
+  // true if the update should be applied, remembers its tick then
+  bool accept(uint16_t eid, uint16_t tick) {
+    if (eid >= ticks_.size())
+    {
+      ticks_.resize(size_t(eid) + 1, 0);
+      seen_.resize(size_t(eid) + 1, false);
+    }
+    if (seen_[eid] && sequence_less(tick, ticks_[eid]))
+      return false;
+    ticks_[eid] = tick;
+    seen_[eid] = true;
+    return true;
+  }
+
+  // the eid went to another entity
+  void reset(uint16_t eid) {
+    if (eid < seen_.size())
+      seen_[eid] = false;
+  }
+
+private:
+  std::vector<uint16_t> ticks_;
+  std::vector<bool> seen_;
+};
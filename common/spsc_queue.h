@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Each side keeps a plain copy of the other's index and reloads the atomic only when the copy says
+// full / empty, so a push or pop is usually one relaxed load, the slot copy and one release store.
+// Head and tail sit on their own cache lines, the two threads don't keep stealing one from each other.
+
+constexpr size_t cache_line_size = 64;
+
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "ASSERT: capacity must be a power of two");
+
+public:
+  // producer only, false when full
+  bool push(const T &value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - headCache_ == Capacity)
+    {
+      headCache_ = head_.load(std::memory_order_acquire);
+      if (tail - headCache_ == Capacity)
+        return false;
+    }
+    slots_[tail & (Capacity - 1)] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, false when empty
+  bool pop(T &value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tailCache_)
+    {
+      tailCache_ = tail_.load(std::memory_order_acquire);
+      if (head == tailCache_)
+        return false;
+    }
+    value = slots_[head & (Capacity - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // a snapshot, either side may be moving it
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  // consumer's line
+  alignas(cache_line_size) std::atomic<size_t> head_{0};
+  size_t tailCache_ = 0;
+  // producer's line
+  alignas(cache_line_size) std::atomic<size_t> tail_{0};
+  size_t headCache_ = 0;
+
+  alignas(cache_line_size) std::array<T, Capacity> slots_{};
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#if defined(__linux__)
+#include <cerrno>
+#include <time.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+// Fixed-rate server tick on an absolute timeline: tick n is due at start + n * period, so time spent
+// working or oversleeping doesn't push later ticks back. Waiting for the next tick is spent in the
+// network service (ENet's timeout is whole ms), only the last ms is a precise absolute sleep.
+//
+//   TickScheduler scheduler(100);
+//   while (true)
+//   {
+//     uint32_t ticks = scheduler.wait([&](uint32_t timeout_ms) { service_network(server, timeout_ms); });
+//     for (uint32_t t = 0; t < ticks; ++t)
+//       simulate(scheduler.dt());
+//     send_snapshots();
+//     scheduler.tick_done();
+//   }
+
+namespace tick_clock
+{
+  inline int64_t now_ns()
+  {
+#if defined(__linux__)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  inline void sleep_until_ns(int64_t deadline_ns)
+  {
+#if defined(__linux__)
+    timespec ts;
+    ts.tv_sec = deadline_ns / 1'000'000'000;
+    ts.tv_nsec = deadline_ns % 1'000'000'000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+      ;
+#else
+    std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline_ns)));
+#endif
+  }
+}
+
+struct TickMetrics
+{
+  uint64_t waits = 0;         // calls to wait()
+  uint64_t ticks = 0;         // ticks handed out to simulate
+  uint64_t droppedTicks = 0;  // behind by more than the catch-up limit, never simulated
+  uint64_t overruns = 0;      // work finished after the next tick was already due
+  int64_t totalLatenessNs = 0; // wake-up past the deadline
+  int64_t maxLatenessNs = 0;
+  int64_t totalWorkNs = 0;
+  int64_t maxWorkNs = 0;
+};
+
+inline void print_tick_metrics(const TickMetrics &metrics)
+{
+  if (metrics.waits == 0)
+    return;
+  printf("ticks %llu (dropped %llu), overruns %llu, late by avg %.1f max %.1f us, work avg %.1f max %.1f us\n",
+         (unsigned long long)metrics.ticks, (unsigned long long)metrics.droppedTicks,
+         (unsigned long long)metrics.overruns,
+         metrics.totalLatenessNs * 0.001 / metrics.waits, metrics.maxLatenessNs * 0.001,
+         metrics.totalWorkNs * 0.001 / metrics.waits, metrics.maxWorkNs * 0.001);
+}
+
+class TickScheduler {
+public:
+  // max_catch_up_ticks: how many ticks one wait() may return after a stall, older ones are dropped
+  explicit TickScheduler(uint32_t ticks_per_second, uint32_t max_catch_up_ticks = 5)
+    : periodNs_(1'000'000'000 / int64_t(ticks_per_second)),
+      maxCatchUp_(max_catch_up_ticks > 0 ? max_catch_up_ticks : 1),
+      nextDeadlineNs_(tick_clock::now_ns() + periodNs_) {
+  }
+
+  // Runs service(timeout_ms) until the next tick is due, returns how many ticks to simulate now:
+  // 1 when on time, more when behind. service should return early when a packet arrives.
+  template <typename Service>
+  uint32_t wait(Service &&service) {
+    constexpr int64_t msNs = 1'000'000;
+    int64_t now = tick_clock::now_ns();
+    while (nextDeadlineNs_ - now > 2 * msNs)
+    {
+      service(static_cast<uint32_t>((nextDeadlineNs_ - now - msNs) / msNs));
+      now = tick_clock::now_ns();
+    }
+    service(0u); // whatever came in meanwhile, also when we're already late
+    if (now < nextDeadlineNs_)
+      tick_clock::sleep_until_ns(nextDeadlineNs_);
+
+    now = tick_clock::now_ns();
+    const int64_t lateness = now > nextDeadlineNs_ ? now - nextDeadlineNs_ : 0;
+    uint64_t due = 1 + uint64_t(lateness / periodNs_);
+    nextDeadlineNs_ += int64_t(due) * periodNs_; // stays on the grid, dropped ticks included
+    if (due > maxCatchUp_)
+    {
+      metrics_.droppedTicks += due - maxCatchUp_;
+      due = maxCatchUp_;
+    }
+
+    tickStartNs_ = now;
+    ++metrics_.waits;
+    metrics_.ticks += due;
+    metrics_.totalLatenessNs += lateness;
+    if (lateness > metrics_.maxLatenessNs)
+      metrics_.maxLatenessNs = lateness;
+    tickCount_ += due;
+    return static_cast<uint32_t>(due);
+  }
+
+  // end of the work after wait(), for the overrun metrics
+  void tick_done() {
+    const int64_t now = tick_clock::now_ns();
+    const int64_t work = now - tickStartNs_;
+    metrics_.totalWorkNs += work;
+    if (work > metrics_.maxWorkNs)
+      metrics_.maxWorkNs = work;
+    if (now > nextDeadlineNs_)
+      ++metrics_.overruns;
+  }
+
+  float dt() const { return static_cast<float>(periodNs_) * 1e-9f; }
+  int64_t period_ns() const { return periodNs_; }
+  uint64_t tick_count() const { return tickCount_; }
+
+  const TickMetrics &metrics() const { return metrics_; }
+  void reset_metrics() { metrics_ = TickMetrics(); }
+
+private:
+  int64_t periodNs_;
+  uint32_t maxCatchUp_;
+  int64_t nextDeadlineNs_;
+  int64_t tickStartNs_ = 0;
+  uint64_t tickCount_ = 0;
+  TickMetrics metrics_;
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "bitstream.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+// Zigzag maps signed deltas to unsigned so that small magnitudes get small codes: 0, -1, 1, -2, 2 -> 0, 1, 2, 3, 4
+inline uint32_t zigzag_encode(int32_t value)
+{
+  return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t zigzag_decode(uint32_t value)
+{
+  return static_cast<int32_t>((value >> 1) ^ (0u - (value & 1)));
+}
+
+inline uint64_t zigzag_encode(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+  return static_cast<int64_t>((value >> 1) ^ (0ull - (value & 1)));
+}
+
+///--------------------------------------------------
+/// Prefix varint on a Bitstream: n leading one bits (terminated by a zero unless n == 8)
+/// say how many extra bytes follow, the code always takes a whole number of bytes.
+///   1 byte: 7 bits, 2 bytes: 14 bits, ..., 8 bytes: 56 bits, 9 bytes: 64 bits
+
+inline uint32_t varint_size(uint64_t value)
+{
+  for (uint32_t num_bytes = 1; num_bytes <= 8; ++num_bytes)
+    if (value < (1ull << (7 * num_bytes)))
+      return num_bytes;
+  return 9;
+}
+
+inline void write_varint(Bitstream& bs, uint64_t value)
+{
+  const uint32_t num_bytes = varint_size(value);
+  const uint32_t extra = num_bytes - 1;
+
+  // prefix: extra ones, then a terminating zero
+  if (extra > 0)
+    bs.write_bits((1u << extra) - 1, extra);
+  if (extra < 8)
+    bs.write_bits(0, 1);
+
+  uint32_t payload_bits = num_bytes == 9 ? 64 : 7 * num_bytes;
+  while (payload_bits > 0)
+  {
+    const uint32_t chunk = payload_bits > 32 ? 32 : payload_bits;
+    bs.write_bits(static_cast<uint32_t>(value), chunk);
+    value >>= chunk;
+    payload_bits -= chunk;
+  }
+}
+
+inline uint64_t read_varint(Bitstream& bs)
+{
+  uint32_t extra = 0;
+  while (extra < 8 && bs.read_bits(1) != 0)
+    ++extra;
+
+  const uint32_t num_bytes = extra + 1;
+  uint32_t payload_bits = num_bytes == 9 ? 64 : 7 * num_bytes;
+  uint64_t value = 0;
+  uint32_t shift = 0;
+  while (payload_bits > 0)
+  {
+    const uint32_t chunk = payload_bits > 32 ? 32 : payload_bits;
+    value |= static_cast<uint64_t>(bs.read_bits(chunk)) << shift;
+    shift += chunk;
+    payload_bits -= chunk;
+  }
+  return value;
+}
+
+inline void write_zigzag(Bitstream& bs, int64_t value)
+{
+  write_varint(bs, zigzag_encode(value));
+}
+
+inline int64_t read_zigzag(Bitstream& bs)
+{
+  return zigzag_decode(read_varint(bs));
+}
+
+///--------------------------------------------------
+/// Batch codec for arrays of 32-bit values (entity ids, deltas), "stream vbyte" layout:
+/// 2-bit length codes for 4 values are packed into a control byte, all control bytes come first,
+/// followed by the 1..4 significant bytes of every value. Decoding 4 values is one table lookup
+/// and one byte shuffle, done with SSSE3 when the build enables it.
+
+inline size_t varint_batch_max_size(size_t count)
+{
+  return (count + 3) / 4 + count * sizeof(uint32_t);
+}
+
+inline uint32_t varint_batch_byte_count(uint32_t value)
+{
+  return value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+}
+
+// out must hold varint_batch_max_size(count) bytes, returns number of bytes written
+inline size_t encode_uint_batch(const uint32_t* values, size_t count, uint8_t* out)
+{
+  uint8_t* control = out;
+  uint8_t* data = out + (count + 3) / 4;
+  memset(control, 0, (count + 3) / 4);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const uint32_t num_bytes = varint_batch_byte_count(values[i]);
+    control[i / 4] |= static_cast<uint8_t>((num_bytes - 1) << ((i % 4) * 2));
+    const uint32_t le = to_wire_endian(values[i]);
+    memcpy(data, &le, num_bytes);
+    data += num_bytes;
+  }
+  return static_cast<size_t>(data - out);
+}
+
+// zigzag(values[i] - values[i - 1]), so sorted or slowly changing arrays shrink to 1 byte per value
+inline size_t encode_delta_batch(const uint32_t* values, size_t count, uint32_t* scratch, uint8_t* out)
+{
+  uint32_t prev = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    scratch[i] = zigzag_encode(static_cast<int32_t>(values[i] - prev));
+    prev = values[i];
+  }
+  return encode_uint_batch(scratch, count, out);
+}
+
+namespace varint_detail
+{
+  struct ShuffleTable
+  {
+    uint8_t masks[256][16];
+    uint8_t lengths[256];
+  };
+
+  constexpr ShuffleTable make_shuffle_table()
+  {
+    ShuffleTable table{};
+    for (uint32_t control = 0; control < 256; ++control)
+    {
+      uint8_t src = 0;
+      for (uint32_t lane = 0; lane < 4; ++lane)
+      {
+        const uint32_t num_bytes = ((control >> (lane * 2)) & 3) + 1;
+        for (uint32_t b = 0; b < 4; ++b)
+          table.masks[control][lane * 4 + b] = b < num_bytes ? src++ : 0x80; // 0x80 zeroes the byte
+      }
+      table.lengths[control] = src;
+    }
+    return table;
+  }
+
+  inline constexpr ShuffleTable shuffle_table = make_shuffle_table();
+
+  // returns nullptr when the group runs past end
+  inline const uint8_t* decode_group_scalar(uint8_t control, const uint8_t* data, const uint8_t* end,
+                                            uint32_t* out, size_t n)
+  {
+    for (size_t lane = 0; lane < n; ++lane)
+    {
+      const uint32_t num_bytes = ((control >> (lane * 2)) & 3) + 1;
+      const size_t available = static_cast<size_t>(end - data);
+      if (available < num_bytes)
+        return nullptr;
+      uint32_t le = 0;
+      if (available >= sizeof(uint32_t))
+      {
+        // one fixed-size load and a mask instead of a variable-length copy
+        memcpy(&le, data, sizeof(uint32_t));
+        le = from_wire_endian(le) & (0xffffffffu >> (32 - num_bytes * 8));
+      }
+      else
+      {
+        memcpy(&le, data, num_bytes);
+        le = from_wire_endian(le);
+      }
+      out[lane] = le;
+      data += num_bytes;
+    }
+    return data;
+  }
+}
+
+// size is the number of bytes available in in, returns number of bytes consumed or 0 on malformed input
+inline size_t decode_uint_batch_scalar(const uint8_t* in, size_t size, size_t count, uint32_t* out)
+{
+  const size_t control_size = (count + 3) / 4;
+  if (size < control_size)
+    return 0;
+  const uint8_t* data = in + control_size;
+  const uint8_t* end = in + size;
+  for (size_t i = 0; i < count; i += 4)
+  {
+    const size_t n = count - i < 4 ? count - i : 4;
+    data = varint_detail::decode_group_scalar(in[i / 4], data, end, out + i, n);
+    if (data == nullptr)
+      return 0;
+  }
+  return static_cast<size_t>(data - in);
+}
+
+inline size_t decode_uint_batch(const uint8_t* in, size_t size, size_t count, uint32_t* out)
+{
+#if defined(__SSSE3__)
+  const size_t control_size = (count + 3) / 4;
+  if (size < control_size)
+    return 0;
+  const uint8_t* data = in + control_size;
+  const uint8_t* end = in + size;
+  size_t i = 0;
+  // a group is at most 16 bytes, the shuffle loads 16 unconditionally, so stop while that is still in bounds
+  for (; i + 4 <= count && end - data >= 16; i += 4)
+  {
+    const uint8_t control = in[i / 4];
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(varint_detail::shuffle_table.masks[control]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(bytes, mask));
+    data += varint_detail::shuffle_table.lengths[control];
+  }
+  if (i == count)
+    return static_cast<size_t>(data - in);
+
+  // tail groups near the end of the buffer
+  for (; i < count; i += 4)
+  {
+    const size_t n = count - i < 4 ? count - i : 4;
+    data = varint_detail::decode_group_scalar(in[i / 4], data, end, out + i, n);
+    if (data == nullptr)
+      return 0;
+  }
+  return static_cast<size_t>(data - in);
+#else
+  return decode_uint_batch_scalar(in, size, count, out);
+#endif
+}
+
+// inverse of encode_delta_batch: zigzag decode and prefix sum, 4 lanes at a time with SSSE3
+inline size_t decode_delta_batch(const uint8_t* in, size_t size, size_t count, uint32_t* out)
+{
+  const size_t consumed = decode_uint_batch(in, size, count, out);
+  if (consumed == 0 && count > 0)
+    return 0;
+
+  size_t i = 0;
+  uint32_t prev = 0;
+#if defined(__SSSE3__)
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i running = _mm_setzero_si128();
+  const size_t simd_count = count & ~size_t(3);
+  for (; i < simd_count; i += 4)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + i));
+    v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, running);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    running = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  prev = static_cast<uint32_t>(_mm_cvtsi128_si32(running));
+#endif
+  for (; i < count; ++i)
+  {
+    prev += static_cast<uint32_t>(zigzag_decode(out[i]));
+    out[i] = prev;
+  }
+  return consumed;
+}
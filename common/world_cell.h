@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Positions on the wire are a coarse cell plus a fine offset from the cell centre. The offset is
+// quantised over the cell grown by a margin, an entity only switches cells once it leaves that
+// grown box, so one driving along a border doesn't flip back and forth. Cell (0, 0) is the old
+// -16..16 x -8..8 world box.
+//
+// The cell is sent only when it changes (reliably, as zigzag varints), snapshots carry the parity
+// of the entity's cell generation so the client can drop offsets meant for a cell it doesn't know yet.
+
+constexpr float cell_size_x = 32.f;
+constexpr float cell_size_y = 16.f;
+constexpr float cell_offset_range_x = cell_size_x * 0.5f * 1.25f;
+constexpr float cell_offset_range_y = cell_size_y * 0.5f * 1.25f;
+
+struct WorldCell
+{
+  int32_t x = 0;
+  int32_t y = 0;
+};
+
+inline bool operator==(const WorldCell &a, const WorldCell &b) { return a.x == b.x && a.y == b.y; }
+inline bool operator!=(const WorldCell &a, const WorldCell &b) { return !(a == b); }
+
+inline float cell_origin_x(const WorldCell &cell) { return static_cast<float>(cell.x) * cell_size_x; }
+inline float cell_origin_y(const WorldCell &cell) { return static_cast<float>(cell.y) * cell_size_y; }
+
+inline WorldCell cell_of(float x, float y)
+{
+  return {static_cast<int32_t>(std::floor(x / cell_size_x + 0.5f)),
+          static_cast<int32_t>(std::floor(y / cell_size_y + 0.5f))};
+}
+
+// returns true when the entity moved to another cell
+inline bool update_cell(WorldCell &cell, float x, float y)
+{
+  if (std::fabs(x - cell_origin_x(cell)) <= cell_offset_range_x &&
+      std::fabs(y - cell_origin_y(cell)) <= cell_offset_range_y)
+    return false;
+  cell = cell_of(x, y);
+  return true;
+}
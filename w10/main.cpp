@@ -8,20 +8,22 @@
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "entity_registry.h"
+#include "host_options.h"
+#include "sequence.h"
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
+static EntityTickFilter snapshotTicks;
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.emplace_at(newEntity.eid, newEntity);
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -29,19 +31,45 @@ void on_set_controlled_entity(ENetPacket *packet)
   deserialize_set_controlled_entity(packet, my_entity);
 }
 
+void on_entity_cell(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  WorldCell cell;
+  uint8_t cellGen = 0;
+  deserialize_entity_cell(packet, eid, cell, cellGen);
+  if (Entity *e = entities.find(eid))
+  {
+    e->cell = cell;
+    e->cellGen = cellGen;
+  }
+}
+
 void on_snapshot(ENetPacket *packet)
 {
   uint16_t eid = invalid_entity;
+  uint16_t tick = 0;
+  uint8_t cellGenParity = 0;
   float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
-    }
+  if (!deserialize_snapshot(packet, eid, tick, cellGenParity, x, y, ori))
+    return;
+  Entity *e = entities.find(eid);
+  // offset from a cell we haven't been told about yet (or an old one), can't place it
+  if (!e || cellGenParity != (e->cellGen & 1))
+    return;
+  if (!snapshotTicks.accept(eid, tick))
+    return;
+  e->x = cell_origin_x(e->cell) + x;
+  e->y = cell_origin_y(e->cell) + y;
+  e->ori = ori;
+}
+
+// a player left, its eid is free for the next one to join
+void on_remove_entity(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  deserialize_remove_entity(packet, eid);
+  if (entities.remove_at(eid))
+    snapshotTicks.reset(eid);
 }
 
 void on_key(ENetPacket *packet)
@@ -63,6 +91,7 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet client\n");
     return 1;
   }
+  apply_host_options(client, argc, argv);
 
   ENetAddress address;
   enet_address_set_host(&address, "localhost");
@@ -124,9 +153,15 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SNAPSHOT:
           on_snapshot(event.packet);
           break;
+        case E_SERVER_TO_CLIENT_ENTITY_CELL:
+          on_entity_cell(event.packet);
+          break;
         case E_SERVER_TO_CLIENT_KEY:
           on_key(event.packet);
           break;
+        case E_SERVER_TO_CLIENT_REMOVE_ENTITY:
+          on_remove_entity(event.packet);
+          break;
         };
         break;
       default:
@@ -139,17 +174,15 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+      if (entities.contains(my_entity))
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
 
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
+        // Send
+        send_entity_input(serverPeer, my_entity, thr, steer);
+      }
     }
 
     BeginDrawing();
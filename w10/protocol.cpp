@@ -1,50 +1,63 @@
 #include "protocol.h"
+#include "net_send.h"
 #include "quantisation.h"
+#include "message_schema.h"
+#include "varint.h"
 #include <cstring> // memcpy
 #include <iostream>
 #include <stdlib.h>
 
 static uint32_t xorCipherKey = 0;
 
+typedef MessageSchema<E_CLIENT_TO_SERVER_JOIN> JoinMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_NEW_ENTITY, RawField<Entity>> NewEntityMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, Field<uint16_t>> SetControlledEntityMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_KEY, Field<uint32_t>> CipherKeyMsg;
+typedef MessageSchema<E_CLIENT_TO_SERVER_INPUT, Field<uint16_t>, Field<float>, Field<float>> EntityInputMsg;
+// eid, precision level, server tick, cell generation parity, then cell offset x, y and orientation
+// in 11, 10 and 8 bits minus the ones the level drops
+typedef MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint8_t, precision_level_bits>> SnapshotHeaderMsg;
+template <PrecisionLevel level>
+using SnapshotMsg = MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint8_t, precision_level_bits>,
+                                  Field<uint16_t>, Field<uint8_t, 1>,
+                                  Field<uint16_t, 11 - precision_drop[level].x>,
+                                  Field<uint16_t, 10 - precision_drop[level].y>,
+                                  Field<uint8_t, 8 - precision_drop[level].ori>>;
+// eid, cell generation, then cell x and y as zigzag varints
+typedef MessageSchema<E_SERVER_TO_CLIENT_ENTITY_CELL, Field<uint16_t>, Field<uint8_t>> EntityCellHeaderMsg;
+constexpr size_t entity_cell_max_bytes = EntityCellHeaderMsg::num_bytes + 2 * 5;
+typedef MessageSchema<E_SERVER_TO_CLIENT_REMOVE_ENTITY, Field<uint16_t>> RemoveEntityMsg;
+
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  ENetPacket *packet = enet_packet_create(nullptr, JoinMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  JoinMsg::write(packet->data);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  ENetPacket *packet = enet_packet_create(nullptr, NewEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  NewEntityMsg::write(packet->data, ent);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  ENetPacket *packet = enet_packet_create(nullptr, SetControlledEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  SetControlledEntityMsg::write(packet->data, eid);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_cipher_key(ENetPeer *peer, uint32_t key)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_KEY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &key, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  ENetPacket *packet = enet_packet_create(nullptr, CipherKeyMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  CipherKeyMsg::write(packet->data, key);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void fuzz_packet_data(ENetPacket *packet)
@@ -54,51 +67,74 @@ void fuzz_packet_data(ENetPacket *packet)
 
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(float) * 2,
-                                                   //sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
-  /*
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
+  ENetPacket *packet = enet_packet_create(nullptr, EntityInputMsg::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  EntityInputMsg::write(packet->data, eid, thr, ori);
 
   fuzz_packet_data(packet);
   cipher_data(packet);
 
-  enet_peer_send(peer, 1, packet);
+  net_send(peer, 1, packet);
+}
+
+template <PrecisionLevel level>
+static ENetPacket *create_snapshot_packet(uint16_t eid, uint16_t tick, uint8_t cell_gen, uint16_t x_packed,
+                                          uint16_t y_packed, uint8_t ori_packed)
+{
+  constexpr PrecisionDrop drop = precision_drop[level];
+  ENetPacket *packet = enet_packet_create(nullptr, SnapshotMsg<level>::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  SnapshotMsg<level>::write(packet->data, eid, level, tick, static_cast<uint8_t>(cell_gen & 1),
+                            reduce_precision(x_packed, drop.x),
+                            reduce_precision(y_packed, drop.y),
+                            reduce_precision(ori_packed, drop.ori));
+  return packet;
+}
+
+void send_snapshot(ENetPeer *peer, const Entity &ent, uint16_t tick, PrecisionLevel level)
+{
+  uint16_t xPacked = pack_float<uint16_t>(ent.x - cell_origin_x(ent.cell), -cell_offset_range_x, cell_offset_range_x, 11);
+  uint16_t yPacked = pack_float<uint16_t>(ent.y - cell_origin_y(ent.cell), -cell_offset_range_y, cell_offset_range_y, 10);
+  uint8_t oriPacked = pack_float<uint8_t>(ent.ori, -PI, PI, 8);
+  const uint16_t eid = ent.eid;
+  const uint8_t cellGen = ent.cellGen;
+
+  ENetPacket *packet = nullptr;
+  switch (level)
+  {
+  case E_PRECISION_FULL:
+    packet = create_snapshot_packet<E_PRECISION_FULL>(eid, tick, cellGen, xPacked, yPacked, oriPacked);
+    break;
+  case E_PRECISION_MEDIUM:
+    packet = create_snapshot_packet<E_PRECISION_MEDIUM>(eid, tick, cellGen, xPacked, yPacked, oriPacked);
+    break;
+  default:
+    packet = create_snapshot_packet<E_PRECISION_LOW>(eid, tick, cellGen, xPacked, yPacked, oriPacked);
+    break;
+  }
+
+  net_send(peer, 1, packet);
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+// reliable and on the same channel as new entities, so the client never sees a cell for an unknown eid
+void send_entity_cell(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  uint16_t xPacked = pack_float<uint16_t>(x, -16.f, 16.f, 11);
-  uint16_t yPacked = pack_float<uint16_t>(y, -8.f, 8.f, 10);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  uint8_t buffer[entity_cell_max_bytes];
+  Bitstream bs(buffer, sizeof(buffer));
+  EntityCellHeaderMsg::write(bs, ent.eid, ent.cellGen);
+  write_zigzag(bs, ent.cell.x);
+  write_zigzag(bs, ent.cell.y);
+  bs.flush();
 
-  enet_peer_send(peer, 1, packet);
+  ENetPacket *packet = enet_packet_create(buffer, bs.bytes_processed(), ENET_PACKET_FLAG_RELIABLE);
+  net_send(peer, 0, packet);
+}
+
+// reliable on the new entity channel too, the removal can't overtake the entity's creation
+void send_remove_entity(ENetPeer *peer, uint16_t eid)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, RemoveEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  RemoveEntityMsg::write(packet->data, eid);
+
+  net_send(peer, 0, packet);
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -108,14 +144,18 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  MessageView<NewEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  ent = view.get<0>();
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  MessageView<SetControlledEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
 }
 
 void xor_packet_data(ENetPacket *packet, uint8_t *key_ptr)
@@ -141,40 +181,93 @@ void decipher_data(ENetPacket *packet, ENetPeer *peer)
 
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  MessageView<EntityInputMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
+  thr = view.get<1>();
+  steer = view.get<2>();
+}
 
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
-  //uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  /*
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-  */
-}
-
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+template <PrecisionLevel level>
+static bool read_snapshot_packet(ENetPacket *packet, uint16_t &eid, uint16_t &tick, uint8_t &cell_gen_parity,
+                                 uint16_t &x_packed, uint16_t &y_packed, uint8_t &ori_packed)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = unpack_float<uint16_t>(xPacked, -16.f, 16.f, 11);
-  y = unpack_float<uint16_t>(yPacked, -8.f, 8.f, 10);
+  constexpr PrecisionDrop drop = precision_drop[level];
+  MessageView<SnapshotMsg<level>> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return false;
+  eid = view.template get<0>();
+  tick = view.template get<2>();
+  cell_gen_parity = view.template get<3>();
+  x_packed = static_cast<uint16_t>(restore_precision(view.template get<4>(), drop.x));
+  y_packed = static_cast<uint16_t>(restore_precision(view.template get<5>(), drop.y));
+  ori_packed = static_cast<uint8_t>(restore_precision(view.template get<6>(), drop.ori));
+  return true;
+}
+
+bool deserialize_snapshot(ENetPacket *packet, uint16_t &eid, uint16_t &tick, uint8_t &cell_gen_parity, float &x, float &y,
+                          float &ori)
+{
+  MessageView<SnapshotHeaderMsg> header(packet->data, packet->dataLength);
+  if (!header.valid())
+    return false;
+
+  uint16_t xPacked = 0;
+  uint16_t yPacked = 0;
+  uint8_t oriPacked = 0;
+  bool ok = false;
+  switch (header.get<1>())
+  {
+  case E_PRECISION_FULL:
+    ok = read_snapshot_packet<E_PRECISION_FULL>(packet, eid, tick, cell_gen_parity, xPacked, yPacked, oriPacked);
+    break;
+  case E_PRECISION_MEDIUM:
+    ok = read_snapshot_packet<E_PRECISION_MEDIUM>(packet, eid, tick, cell_gen_parity, xPacked, yPacked, oriPacked);
+    break;
+  case E_PRECISION_LOW:
+    ok = read_snapshot_packet<E_PRECISION_LOW>(packet, eid, tick, cell_gen_parity, xPacked, yPacked, oriPacked);
+    break;
+  default:
+    break;
+  }
+  if (!ok)
+    return false;
+
+  x = unpack_float<uint16_t>(xPacked, -cell_offset_range_x, cell_offset_range_x, 11);
+  y = unpack_float<uint16_t>(yPacked, -cell_offset_range_y, cell_offset_range_y, 10);
   ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  return true;
 }
 
-void deserialize_and_set_key(ENetPacket *packet)
+void deserialize_entity_cell(ENetPacket *packet, uint16_t &eid, WorldCell &cell, uint8_t &cell_gen)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  xorCipherKey = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  Bitstream bs(packet->data, packet->dataLength);
+  uint16_t cellEid = invalid_entity;
+  uint8_t gen = 0;
+  if (!EntityCellHeaderMsg::read(bs, cellEid, gen))
+    return;
+  const int64_t cx = read_zigzag(bs);
+  const int64_t cy = read_zigzag(bs);
+  if (bs.overflow())
+    return;
+  eid = cellEid;
+  cell = {static_cast<int32_t>(cx), static_cast<int32_t>(cy)};
+  cell_gen = gen;
+}
+
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid)
+{
+  MessageView<RemoveEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
 }
 
+void deserialize_and_set_key(ENetPacket *packet)
+{
+  MessageView<CipherKeyMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  xorCipherKey = view.get<0>();
+}
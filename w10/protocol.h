@@ -2,6 +2,7 @@
 #include <enet/enet.h>
 #include <cstdint>
 #include "entity.h"
+#include "precision.h"
 
 enum MessageType : uint8_t
 {
@@ -10,7 +11,9 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_KEY
+  E_SERVER_TO_CLIENT_KEY,
+  E_SERVER_TO_CLIENT_ENTITY_CELL,
+  E_SERVER_TO_CLIENT_REMOVE_ENTITY
 };
 
 void send_join(ENetPeer *peer);
@@ -18,14 +21,22 @@ void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_cipher_key(ENetPeer *peer, uint32_t key);
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// position is sent as an offset from the entity's cell
+void send_snapshot(ENetPeer *peer, const Entity &ent, uint16_t tick, PrecisionLevel level);
+void send_entity_cell(ENetPeer *peer, const Entity &ent);
+// the entity is gone for good, its eid may come back as a new one
+void send_remove_entity(ENetPeer *peer, uint16_t eid);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+// x and y are the offset from the cell, cell_gen_parity is the low bit of the cell generation it belongs to
+bool deserialize_snapshot(ENetPacket *packet, uint16_t &eid, uint16_t &tick, uint8_t &cell_gen_parity, float &x, float &y,
+                          float &ori);
+void deserialize_entity_cell(ENetPacket *packet, uint16_t &eid, WorldCell &cell, uint8_t &cell_gen);
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_and_set_key(ENetPacket *packet);
 
 void cipher_data(ENetPacket *packet);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "entity.h"
+#include "entity_registry.h"
+#include "packet_batch.h"
+#include "room_scheduler.h"
+
+// One match (room_scheduler.h): the cars of its players and the peers playing it
+struct Room
+{
+  uint32_t id = 0;
+  EntityRegistry<Entity> entities{max_wire_entities};
+  std::map<uint16_t, ENetPeer*> controlledMap;
+  std::map<ENetPeer*, uint16_t> viewerMap;
+  std::vector<ENetPeer*> peers; // playing in it, in join order
+  uint16_t serverTick = 0;      // stamped on snapshots, wraps around
+  RoomClock clock;
+  PacketBatch outbox;           // slot 0 for the room's own messages, then one per peer
+
+  bool awake() const { return !peers.empty(); }
+};
+
+// the world of a room nobody plays in anymore, the next match starts from scratch
+inline void reset_room(Room &room)
+{
+  room.entities = EntityRegistry<Entity>(max_wire_entities);
+  room.controlledMap.clear();
+  room.viewerMap.clear();
+  room.serverTick = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "sequence.h"
+
+// Server-side position history for lag compensation. A player moves and collides on what it saw:
+// the snapshots of some earlier server tick (its view tick, sent back with every state). Collisions
+// involving it are checked against where the others were at that tick, rewound at most MAX_REWIND_TICKS.
+//
+// One frame per tick, SoA by eid: 1k entities are 14 KB a frame and 224 KB for the whole history,
+// recording is one pass of plain stores per tick.
+
+const uint16_t MAX_REWIND_TICKS = 12; // 200 ms at 60 Hz
+const uint16_t POSITION_HISTORY_TICKS = 16;
+static_assert(POSITION_HISTORY_TICKS > MAX_REWIND_TICKS, "ASSERT: the oldest rewind tick has to be kept");
+
+// view tick clamped into [current - MAX_REWIND_TICKS, current], a view from the future is the current tick
+inline uint16_t clamp_rewind(uint16_t current_tick, uint16_t view_tick)
+{
+  const int16_t behind = sequence_diff(current_tick, view_tick);
+  if (behind <= 0)
+    return current_tick;
+  if (behind > MAX_REWIND_TICKS)
+    return static_cast<uint16_t>(current_tick - MAX_REWIND_TICKS);
+  return view_tick;
+}
+
+class PositionHistory {
+public:
+  // the state every entity ends the tick with, what went out in that tick's snapshots
+  void record(uint16_t tick, uint16_t eid, float x, float y, float size) {
+    Frame &frame = frames_[tick % POSITION_HISTORY_TICKS];
+    if (eid >= frame.ticks.size())
+    {
+      const size_t columns = size_t(eid) + 1;
+      frame.xs.resize(columns);
+      frame.ys.resize(columns);
+      frame.sizes.resize(columns);
+      frame.ticks.resize(columns, static_cast<uint16_t>(tick + 1)); // never a match for this tick
+    }
+    frame.xs[eid] = x;
+    frame.ys[eid] = y;
+    frame.sizes[eid] = size;
+    frame.ticks[eid] = tick;
+  }
+
+  // eid was moved somewhere else (eaten and respawned): where it was before can't be collided with anymore,
+  // a rewind to any tick up to now finds nothing and the live entity is used
+  void forget(uint16_t eid) {
+    for (size_t slot = 0; slot < frames_.size(); ++slot)
+      if (eid < frames_[slot].ticks.size())
+        frames_[slot].ticks[eid] = static_cast<uint16_t>(slot + 1); // never a match for this slot
+  }
+
+  // false if eid wasn't around at that tick or the tick is gone from the history
+  bool rewind(uint16_t tick, uint16_t eid, float &x, float &y, float &size) const {
+    const Frame &frame = frames_[tick % POSITION_HISTORY_TICKS];
+    if (eid >= frame.ticks.size() || frame.ticks[eid] != tick)
+      return false;
+    x = frame.xs[eid];
+    y = frame.ys[eid];
+    size = frame.sizes[eid];
+    return true;
+  }
+
+private:
+  struct Frame
+  {
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<float> sizes;
+    std::vector<uint16_t> ticks; // of the last record per eid, stale columns don't match
+  };
+
+  std::array<Frame, POSITION_HISTORY_TICKS> frames_;
+};
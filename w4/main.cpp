@@ -6,20 +6,24 @@
 #include <vector>
 //#include "entity.h"
 #include "protocol.h"
+#include "entity_registry.h"
+#include "host_options.h"
+#include "sequence.h"
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
+static EntityTickFilter snapshotTicks;
+static uint16_t viewTick = 0; // newest server tick shown, sent back with our state
+static bool hasViewTick = false;
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.emplace_at(newEntity.eid, newEntity);
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -30,16 +34,21 @@ void on_set_controlled_entity(ENetPacket *packet)
 void on_snapshot(ENetPacket *packet)
 {
   uint16_t eid = invalid_entity;
+  uint16_t tick = 0;
   float x = 0.f; float y = 0.f; float size = 0.f;
-  deserialize_snapshot(packet, eid, x, y, size);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.x = x;
-      e.y = y;
-      e.size = size;
-    }
+  deserialize_snapshot(packet, eid, tick, x, y, size);
+  Entity *e = entities.find(eid);
+  if (e && snapshotTicks.accept(eid, tick))
+  {
+    e->x = x;
+    e->y = y;
+    e->size = size;
+  }
+  if (eid != my_entity && (!hasViewTick || sequence_greater(tick, viewTick)))
+  {
+    viewTick = tick;
+    hasViewTick = true;
+  }
 }
 
 int main(int argc, const char **argv)
@@ -56,6 +65,7 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet client\n");
     return 1;
   }
+  apply_host_options(client, argc, argv);
 
   ENetAddress address;
   enet_address_set_host(&address, "127.0.0.1");
@@ -130,17 +140,15 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          e.x += ((left ? -dt : 0.f) + (right ? +dt : 0.f)) * 120.f;
-          e.y += ((up ? -dt : 0.f) + (down ? +dt : 0.f)) * 120.f;
+      if (Entity *e = entities.find(my_entity))
+      {
+        // Update
+        e->x += ((left ? -dt : 0.f) + (right ? +dt : 0.f)) * 120.f;
+        e->y += ((up ? -dt : 0.f) + (down ? +dt : 0.f)) * 120.f;
 
-          // Send
-          send_entity_state(serverPeer, my_entity, e.x, e.y);
-        }
+        // Send
+        send_entity_state(serverPeer, my_entity, viewTick, e->x, e->y);
+      }
     }
 
 
@@ -1,64 +1,54 @@
 #include "protocol.h"
+#include "net_send.h"
+#include "message_schema.h"
+#include "half_float.h"
+
+typedef MessageSchema<E_CLIENT_TO_SERVER_JOIN> JoinMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_NEW_ENTITY, RawField<Entity>> NewEntityMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, Field<uint16_t>> SetControlledEntityMsg;
+// eid, last server tick the client has seen, x, y
+typedef MessageSchema<E_CLIENT_TO_SERVER_STATE, Field<uint16_t>, Field<uint16_t>, Field<float>, Field<float>> EntityStateMsg;
+// eid, server tick, x, y, size as a half float
+typedef MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint16_t>, Field<float>, Field<float>, HalfField> SnapshotMsg;
 
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
+  ENetPacket *packet = enet_packet_create(nullptr, JoinMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  JoinMsg::write(packet->data);
 
-  auto bs = Bitstream(packet->data);
-  bs.write(E_CLIENT_TO_SERVER_JOIN);
-
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_NEW_ENTITY);
-  bs.write(ent);
+  ENetPacket *packet = enet_packet_create(nullptr, NewEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  NewEntityMsg::write(packet->data, ent);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY);
-  bs.write(eid);
+  ENetPacket *packet = enet_packet_create(nullptr, SetControlledEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  SetControlledEntityMsg::write(packet->data, eid);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
-void send_entity_state(ENetPeer *peer, uint16_t eid, float x, float y)
+void send_entity_state(ENetPeer *peer, uint16_t eid, uint16_t view_tick, float x, float y)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   2 * sizeof(float),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_CLIENT_TO_SERVER_STATE);
-  bs.write(eid);
-  bs.write(x);
-  bs.write(y);
-
-  enet_peer_send(peer, 1, packet);
+  ENetPacket *packet = enet_packet_create(nullptr, EntityStateMsg::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  EntityStateMsg::write(packet->data, eid, view_tick, x, y);
+
+  net_send(peer, 1, packet);
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float size)
+void send_snapshot(ENetPeer *peer, uint16_t eid, uint16_t tick, float x, float y, float size)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   3 * sizeof(float),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_SNAPSHOT);
-  bs.write(eid);
-  bs.write(x);
-  bs.write(y);
-  bs.write(size);
-
-  enet_peer_send(peer, 1, packet);
+  ENetPacket *packet = enet_packet_create(nullptr, SnapshotMsg::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  SnapshotMsg::write(packet->data, eid, tick, x, y, size);
+
+  net_send(peer, 1, packet);
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -68,42 +58,39 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType mt{};
-
-  bs.read(mt);
-  bs.read(ent);
+  MessageView<NewEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  ent = view.get<0>();
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType mt{};
-
-  bs.read(mt);
-  bs.read(eid);
+  MessageView<SetControlledEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
 }
 
-void deserialize_entity_state(ENetPacket *packet, uint16_t &eid, float &x, float &y)
+void deserialize_entity_state(ENetPacket *packet, uint16_t &eid, uint16_t &view_tick, float &x, float &y)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType mt{};
-
-  bs.read(mt);
-  bs.read(eid);
-  bs.read(x);
-  bs.read(y);
+  MessageView<EntityStateMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
+  view_tick = view.get<1>();
+  x = view.get<2>();
+  y = view.get<3>();
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float& size)
+void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, uint16_t &tick, float &x, float &y, float& size)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType mt{};
-
-  bs.read(mt);
-  bs.read(eid);
-  bs.read(x);
-  bs.read(y);
-  bs.read(size);
+  MessageView<SnapshotMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
+  tick = view.get<1>();
+  x = view.get<2>();
+  y = view.get<3>();
+  size = view.get<4>();
 }
-
@@ -16,13 +16,14 @@ enum MessageType : uint8_t
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_entity_state(ENetPeer *peer, uint16_t eid, float x, float y);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float size);
+// view_tick: newest server tick in the snapshots the client is showing, the server rewinds to it (lag_compensation.h)
+void send_entity_state(ENetPeer *peer, uint16_t eid, uint16_t view_tick, float x, float y);
+void send_snapshot(ENetPeer *peer, uint16_t eid, uint16_t tick, float x, float y, float size);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_state(ENetPacket *packet, uint16_t &eid, float &x, float &y);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float& size);
+void deserialize_entity_state(ENetPacket *packet, uint16_t &eid, uint16_t &view_tick, float &x, float &y);
+void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, uint16_t &tick, float &x, float &y, float& size);
 
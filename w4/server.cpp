@@ -2,18 +2,28 @@
 #include <iostream>
 //#include "entity.h"
 #include "protocol.h"
+#include "entity_registry.h"
+#include "host_options.h"
+#include "tick_scheduler.h"
+#include "net_thread.h"
+#include "lag_compensation.h"
 #include <cstdlib>
 #include <vector>
 #include <map>
 #include <raymath.h>
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities(max_wire_entities);
 static std::map<uint16_t, Vector2> targets;
 static std::map<uint16_t, ENetPeer*> controlledMap;
+static uint16_t serverTick = 0; // stamped on snapshots, wraps around
+static std::map<uint16_t, uint16_t> viewTicks; // per player, the server tick its client was showing
+static PositionHistory positionHistory;
 
 const uint16_t NUM_AI_ENTITIES = 10;
 const uint16_t FPS = 60;
+const uint32_t metrics_report_interval = 10; // seconds
+static InputLatency inputLatency; // receive to tick start, for both threading models
 
 std::random_device rd;
 std::mt19937 gen(rd());
@@ -39,9 +49,13 @@ void gen_ai_entities() {
     Color color = gen_rand_color();
     Vector2 pos = gen_rand_position(350, 350);
 
-    entities.push_back({color, pos.x, pos.y, gen_random_size(), Entity::Type::AI_TYPE, i});
+    EntityHandle handle = entities.create({color, pos.x, pos.y, gen_random_size(), Entity::Type::AI_TYPE});
+    if (handle == invalid_handle)
+      return;
+    uint16_t eid = handle_index(handle);
+    entities.get(handle)->eid = eid;
 
-    targets[i] = gen_rand_position(350, 350);
+    targets[eid] = gen_rand_position(350, 350);
   }
 }
 
@@ -51,16 +65,17 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   for (const Entity &ent : entities)
     send_new_entity(peer, ent);
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-
-  uint16_t newEid = maxEid + 1;
   Color color = gen_rand_color();
   auto pos = gen_rand_position(350, 350);
-  Entity ent = {color, pos.x, pos.y, 10.f, Entity::Type::PLAYER, newEid};
-  entities.push_back(ent);
+  EntityHandle handle = entities.create({color, pos.x, pos.y, 10.f, Entity::Type::PLAYER});
+  if (handle == invalid_handle)
+  {
+    printf("No free entity slot, join refused\n");
+    return;
+  }
+  uint16_t newEid = handle_index(handle);
+  Entity &ent = *entities.get(handle);
+  ent.eid = newEid;
 
   controlledMap[newEid] = peer;
 
@@ -74,14 +89,64 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 void on_state(ENetPacket *packet)
 {
   uint16_t eid = invalid_entity;
+  uint16_t viewTick = 0;
   float x = 0.f; float y = 0.f;
-  deserialize_entity_state(packet, eid, x, y);
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  deserialize_entity_state(packet, eid, viewTick, x, y);
+  if (Entity *e = entities.find(eid))
+  {
+    e->x = x;
+    e->y = y;
+    viewTicks[eid] = viewTick;
+  }
+}
+
+// other as viewer's client showed it, if viewer is a player; the live entity if it can't be rewound
+Entity seen_by(const Entity &viewer, const Entity &other)
+{
+  Entity seen = other;
+  auto it = viewTicks.find(viewer.eid);
+  if (viewer.type != Entity::Type::PLAYER || it == viewTicks.end())
+    return seen;
+  positionHistory.rewind(clamp_rewind(serverTick, it->second), other.eid, seen.x, seen.y, seen.size);
+  return seen;
+}
+
+void handle_event(ENetHost *server, NetEvent &netEvent)
+{
+  ENetEvent &event = netEvent.event;
+  switch (event.type)
+  {
+  case ENET_EVENT_TYPE_CONNECT:
+    printf("Connection with %x:%u established\n", netEvent.address.host, netEvent.address.port);
+    break;
+  case ENET_EVENT_TYPE_RECEIVE:
+    switch (get_packet_type(event.packet))
     {
-      e.x = x;
-      e.y = y;
-    }
+      case E_CLIENT_TO_SERVER_JOIN:
+        on_join(event.packet, event.peer, server);
+        break;
+      case E_CLIENT_TO_SERVER_STATE:
+        on_state(event.packet);
+        break;
+    };
+    enet_packet_destroy(event.packet);
+    break;
+  default:
+    break;
+  };
+}
+
+// single-threaded: blocks for up to timeout_ms until something arrives, then handles everything queued
+void service_network(ENetHost *server, uint32_t timeout_ms)
+{
+  ENetEvent event;
+  while (enet_host_service(server, &event, timeout_ms) > 0)
+  {
+    timeout_ms = 0;
+    NetEvent netEvent = make_net_event(event, tick_clock::now_ns());
+    inputLatency.received(netEvent.recvNs);
+    handle_event(server, netEvent);
+  }
 }
 
 int main(int argc, const char **argv)
@@ -103,35 +168,27 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet server\n");
     return 1;
   }
+  apply_host_options(server, argc, argv);
+
+  // --single-thread: ENet is serviced on the simulation thread between ticks, for comparing the two
+  const bool singleThread = has_option(argc, argv, "--single-thread");
+  NetThread net(server);
+  if (!singleThread)
+    net.start();
 
   gen_ai_entities();
 
+  // collisions send snapshots as they happen, a late tick isn't repeated but dropped
+  TickScheduler scheduler(FPS, 1);
   while (true)
   {
-    ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
-    {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_STATE:
-            on_state(event.packet);
-            break;
-        };
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
-    }
+    scheduler.wait([&](uint32_t timeout_ms) {
+      if (singleThread)
+        service_network(server, timeout_ms);
+      else
+        net.service(timeout_ms, [&](NetEvent &e) { inputLatency.received(e.recvNs); handle_event(server, e); });
+    });
+    inputLatency.tick_started(tick_clock::now_ns());
 
     for (Entity& e : entities)
     {
@@ -141,7 +198,15 @@ int main(int argc, const char **argv)
           continue;
 
         auto type = e.type;
-        auto inner_type = e.type;
+        auto inner_type = e_inner.type;
+
+        // a player moved against what its client showed, the other one is checked where it was back then
+        Entity a = e;
+        Entity b = e_inner;
+        if (type == Entity::Type::PLAYER)
+          b = seen_by(e, e_inner);
+        else if (inner_type == Entity::Type::PLAYER)
+          a = seen_by(e_inner, e);
 
         bool collision;
         float is_circle_size1;
@@ -149,25 +214,25 @@ int main(int argc, const char **argv)
 
         if (type == Entity::Type::AI_TYPE && inner_type == Entity::Type::AI_TYPE)
         {
-          collision = CheckCollisionCircles({e.x, e.y}, e.size / 2.f, {e_inner.x, e_inner.y}, e.size / 2.f);
+          collision = CheckCollisionCircles({a.x, a.y}, a.size / 2.f, {b.x, b.y}, b.size / 2.f);
           is_circle_size1 = e.size / 2.f;
           is_circle_size2 = e_inner.size / 2.f;
         }
         else if (type == Entity::Type::AI_TYPE && inner_type == Entity::Type::PLAYER)
         {
-          collision = CheckCollisionCircleRec({e.x, e.y}, e.size / 2.f, {e_inner.x, e_inner.y, e_inner.size, e_inner.size});
+          collision = CheckCollisionCircleRec({a.x, a.y}, a.size / 2.f, {b.x, b.y, b.size, b.size});
           is_circle_size1 = e.size / 2.f;
           is_circle_size2 = e_inner.size;
         }
         else if (type == Entity::Type::PLAYER && inner_type == Entity::Type::AI_TYPE)
         {
-          collision = CheckCollisionCircleRec({e_inner.x, e_inner.y}, e_inner.size / 2.f, {e.x, e.y, e.size, e.size});
+          collision = CheckCollisionCircleRec({b.x, b.y}, b.size / 2.f, {a.x, a.y, a.size, a.size});
           is_circle_size1 = e.size;
           is_circle_size2 = e_inner.size / 2.f;
         }
         else
         {
-          collision = CheckCollisionRecs({e_inner.x, e_inner.y, e_inner.size, e_inner.size}, {e.x, e.y, e.size, e.size});
+          collision = CheckCollisionRecs({b.x, b.y, b.size, b.size}, {a.x, a.y, a.size, a.size});
           is_circle_size1 = e.size;
           is_circle_size2 = e_inner.size;
         }
@@ -183,6 +248,7 @@ int main(int argc, const char **argv)
           e_inner.size = fmax(e_inner.size / 2.f, 4.f);
           e_inner.x = pos.x;
           e_inner.y = pos.y;
+          positionHistory.forget(e_inner.eid);
         }
         if (is_circle_size2 > is_circle_size1)
         {
@@ -190,13 +256,14 @@ int main(int argc, const char **argv)
           e.size = fmax(e.size / 2.f, 4.f);
           e.x = pos.x;
           e.y = pos.y;
+          positionHistory.forget(e.eid);
         }
 
         if (controlledMap.contains(e_inner.eid))
-          send_snapshot(controlledMap[e_inner.eid], e_inner.eid, e_inner.x, e_inner.y, e_inner.size);
+          send_snapshot(controlledMap[e_inner.eid], e_inner.eid, serverTick, e_inner.x, e_inner.y, e_inner.size);
 
         if (controlledMap.contains(e.eid))
-          send_snapshot(controlledMap[e.eid], e.eid, e.x, e.y, e.size);
+          send_snapshot(controlledMap[e.eid], e.eid, serverTick, e.x, e.y, e.size);
       }
 
       if (e.type == Entity::Type::AI_TYPE)
@@ -214,11 +281,24 @@ int main(int argc, const char **argv)
       {
         ENetPeer *peer = &server->peers[i];
         if (!controlledMap.contains(e.eid) || controlledMap[e.eid] != peer)
-          send_snapshot(peer, e.eid, e.x, e.y, e.size);
+          send_snapshot(peer, e.eid, serverTick, e.x, e.y, e.size);
       }
     }
-//    usleep(20000);
-    usleep(static_cast<useconds_t>(1.f / FPS * 1000000.f));
+    // what this tick's snapshots showed, players will be seeing it for the next few ticks
+    for (const Entity &e : entities)
+      positionHistory.record(serverTick, e.eid, e.x, e.y, e.size);
+    ++serverTick;
+    scheduler.tick_done();
+
+    if (scheduler.metrics().waits == metrics_report_interval * FPS)
+    {
+      print_tick_metrics(scheduler.metrics());
+      scheduler.reset_metrics();
+      inputLatency.print();
+      inputLatency.reset();
+      if (!singleThread)
+        net.print_metrics();
+    }
   }
 
   enet_host_destroy(server);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include "entity.h"
+#include "utilities.h"
+
+// Dead reckoning: a remote entity is carried on from its last snapshot with simulate_entity under the
+// controls and speed that came with it. The server runs the same ghost and sends an entity only when
+// the real one strays from it, or when the client hasn't heard of it for keepAliveTicks
+// (a lost snapshot leaves the client's ghost off until then).
+
+struct DeadReckoningTolerance
+{
+  float distance = 0.05f;
+  float angle = 0.02f; // rad
+  uint32_t keepAliveTicks = TPS; // 1 s
+};
+
+// w5 has one kind of entity, vehicles
+const DeadReckoningTolerance VEHICLE_TOLERANCE;
+
+class DeadReckoning {
+public:
+  // the state a snapshot carried, from here on it's extrapolated
+  void reset(const Entity &sent) {
+    ghost_ = sent;
+    sentTick_ = sent.last_tick;
+    valid_ = true;
+  }
+
+  // same fixed steps as the server, so both sides get the same floats
+  void advance_to(uint32_t tick) {
+    while (ghost_.last_tick < tick)
+    {
+      simulate_entity(ghost_, DT);
+      ghost_.last_tick++;
+    }
+  }
+
+  // call after advance_to(e.last_tick) while valid
+  bool needs_update(const Entity &e, const DeadReckoningTolerance &tolerance) const {
+    if (!valid_ || e.last_tick - sentTick_ >= tolerance.keepAliveTicks)
+      return true;
+    const float dx = e.x - ghost_.x;
+    const float dy = e.y - ghost_.y;
+    return dx * dx + dy * dy > tolerance.distance * tolerance.distance ||
+           std::fabs(e.ori - ghost_.ori) > tolerance.angle;
+  }
+
+  void invalidate() { valid_ = false; }
+  bool valid() const { return valid_; }
+  uint32_t sent_tick() const { return sentTick_; }
+  const Entity &ghost() const { return ghost_; }
+
+private:
+  Entity ghost_;
+  uint32_t sentTick_ = 0;
+  bool valid_ = false;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include "utilities.h"
+
+// Remote entities are drawn on the server's tick timeline, delayed just enough that the snapshot
+// after the render tick has almost always arrived. The delay is one send interval plus the 99th
+// percentile of how late snapshots arrive compared to the fastest one of the last JITTER_WINDOW.
+
+const uint32_t JITTER_WINDOW = 256; // snapshot ticks
+const float JITTER_PERCENTILE = 0.99f;
+const float DELAY_SLEW = 0.1f; // render time runs at most 10% fast or slow while the delay adapts
+
+class JitterBuffer {
+public:
+  // first snapshot of every server tick, the rest of the tick arrived in the same datagram burst
+  void add_sample(uint32_t recv_ms, uint32_t tick) {
+    if (count_ > 0 && tick <= lastTick_)
+      return;
+    if (count_ > 0)
+    {
+      const float gap = static_cast<float>(tick - lastTick_);
+      intervalTicks_ = count_ == 1 ? gap : intervalTicks_ * 0.9f + gap * 0.1f;
+    }
+    lastTick_ = tick;
+
+    // local receive time minus server send time: clock offset + latency, whatever is above its minimum is jitter
+    transits_[next_] = static_cast<double>(recv_ms) - tick * tick_ms;
+    next_ = (next_ + 1) % JITTER_WINDOW;
+    count_ = std::min(count_ + 1, JITTER_WINDOW);
+
+    const double baseline = *std::min_element(transits_.begin(), transits_.begin() + count_);
+    std::array<double, JITTER_WINDOW> lateness;
+    for (uint32_t i = 0; i < count_; ++i)
+      lateness[i] = transits_[i] - baseline;
+    const uint32_t nth = static_cast<uint32_t>(JITTER_PERCENTILE * (count_ - 1));
+    std::nth_element(lateness.begin(), lateness.begin() + nth, lateness.begin() + count_);
+
+    delayMs_ = intervalTicks_ * tick_ms + lateness[nth];
+    targetOffsetMs_ = baseline + delayMs_;
+    if (count_ == 1)
+      offsetMs_ = targetOffsetMs_;
+  }
+
+  // once per frame, moves the render timeline towards the target without jumps
+  void advance(uint32_t now_ms) {
+    const double elapsed = static_cast<double>(now_ms - lastAdvanceMs_);
+    lastAdvanceMs_ = now_ms;
+    if (count_ == 0)
+      return;
+    const double maxStep = elapsed * DELAY_SLEW;
+    offsetMs_ += std::clamp(targetOffsetMs_ - offsetMs_, -maxStep, maxStep);
+  }
+
+  bool ready() const { return count_ > 0; }
+  double render_tick(uint32_t now_ms) const { return (static_cast<double>(now_ms) - offsetMs_) / tick_ms; }
+  double delay_ms() const { return delayMs_; }
+
+private:
+  static constexpr double tick_ms = 1000.0 / TPS;
+
+  std::array<double, JITTER_WINDOW> transits_{};
+  uint32_t next_ = 0;
+  uint32_t count_ = 0;
+  uint32_t lastTick_ = 0;
+  float intervalTicks_ = 0.f;
+  double delayMs_ = 0.0;
+  double targetOffsetMs_ = 0.0;
+  double offsetMs_ = 0.0;
+  uint32_t lastAdvanceMs_ = 0;
+};
@@ -7,105 +7,213 @@
 
 #include <vector>
 #include <map>
-#include <deque>
 #include "entity.h"
 #include "protocol.h"
+#include "jitter_buffer.h"
+#include "snapshot_frames.h"
+#include "dead_reckoning.h"
+#include "entity_registry.h"
+#include "host_options.h"
 
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, std::deque<Snapshot>> snapshots;
+static EntityRegistry<Entity> entities;
+static SnapshotFrames snapshots;
+static std::vector<DeadReckoning> remoteGhosts; // by eid, extrapolated between the snapshots the server skips
+static JitterBuffer jitterBuffer;
 static uint16_t my_entity = invalid_entity;
 
-static std::vector<TickSnapshot> snapshotsHistory;
-static std::vector<TickInput> inputsHistory;
+static TickRing<TickSnapshot, PREDICTION_HISTORY_SIZE> predictedStates;
+static TickRing<TickInput, PREDICTION_HISTORY_SIZE> predictedInputs;
 
-void interpolate_entity(Entity& entity, uint32_t cur_time)
+static int32_t predictionDrift = 0; // ticks our prediction is short of its lead, made up a tick per frame
+static ReconcilePolicy reconcilePolicy;
+static ReconcileStats reconcileStats;
+static ReconcileStats shownReconcileStats; // last full second
+// drawn minus simulated state of our entity, goes back to 0 over blendTime after a correction
+struct RenderOffset
 {
-  auto snap_time = snapshots[entity.eid][1].time;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+static RenderOffset renderOffset;
+
+// all remote entities at once, the local one is predicted instead
+void interpolate_entities(double render_tick)
+{
+  if (!snapshots.sample(render_tick))
+    return;
+  const float *xs = snapshots.xs();
+  const float *ys = snapshots.ys();
+  const float *oris = snapshots.oris();
+  for (Entity &e : entities)
+    if (e.eid != my_entity)
+    {
+      e.x = xs[e.eid];
+      e.y = ys[e.eid];
+      e.ori = oris[e.eid];
+    }
+}
 
-  while (cur_time > snap_time and snapshots[entity.eid].size() > 2) {
-    snapshots[entity.eid].pop_front();
-    snap_time = snapshots[entity.eid][1].time;
+// the server's state for authoritative.tick replaces ours, then only the inputs after it are replayed
+void resimulate_entity(const TickSnapshot &authoritative, Entity& entity)
+{
+  entity.x = authoritative.x;
+  entity.y = authoritative.y;
+  entity.ori = authoritative.ori;
+  entity.speed = authoritative.speed;
+  predictedStates.store(authoritative.tick, {authoritative.tick, entity.x, entity.y, entity.ori, entity.speed});
+
+  for (uint32_t tick = authoritative.tick + 1; tick <= entity.last_tick; ++tick) {
+    const TickInput *input = predictedInputs.find(tick);
+    if (!input)
+      break;
+    entity.thr = input->thr;
+    entity.steer = input->steer;
+    simulate_entity(entity, DT);
+    predictedStates.store(tick, {tick, entity.x, entity.y, entity.ori, entity.speed});
   }
-
-  Snapshot& cur_snap = snapshots[entity.eid][1];
-  Snapshot& prev_snap = snapshots[entity.eid][0];
-
-  float t = static_cast<float>(cur_time - prev_snap.time) / static_cast<float>(cur_snap.time - prev_snap.time);
-
-  entity.x = prev_snap.x + t * (cur_snap.x - prev_snap.x);
-  entity.y = prev_snap.y + t * (cur_snap.y - prev_snap.y);
-  entity.ori = prev_snap.ori + t * (cur_snap.ori - prev_snap.ori);
 }
 
-void resimulate_entity(TickSnapshot snap, Entity& entity)
+// a small error shifts the prediction since tick instead of replaying it, the drawn entity stays
+// where it was and catches up in decay_render_offset
+void shift_prediction(uint32_t from_tick, float dx, float dy, float dori, Entity& entity)
 {
-  entity.x = snap.x;
-  entity.y = snap.y;
-  entity.ori = snap.ori;
-
-  for (const auto& input : inputsHistory) {
-    entity.thr = input.thr;
-    entity.steer = input.steer;
-    simulate_entity(entity, DT);
+  for (uint32_t tick = from_tick; tick <= entity.last_tick; ++tick) {
+    if (TickSnapshot *state = predictedStates.find(tick)) {
+      state->x += dx;
+      state->y += dy;
+      state->ori += dori;
+    }
   }
+  entity.x += dx;
+  entity.y += dy;
+  entity.ori += dori;
+  renderOffset.x -= dx;
+  renderOffset.y -= dy;
+  renderOffset.ori -= dori;
 }
 
-void clear_history(uint32_t tick)
+void decay_render_offset(float dt)
 {
-  std::erase_if(snapshotsHistory, [tick](auto &snapshot){
-    return snapshot.tick < tick;
-  });
-  std::erase_if(inputsHistory, [tick](auto &input){
-    return input.tick < tick;
-  });
+  const float k = expf(-dt / reconcilePolicy.blendTime);
+  renderOffset.x *= k;
+  renderOffset.y *= k;
+  renderOffset.ori *= k;
 }
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.emplace_at(newEntity.eid, newEntity);
 
   if (newEntity.eid != my_entity) {
-    snapshots[newEntity.eid].push_back({enet_time_get(), newEntity.x, newEntity.y, newEntity.ori});
+    snapshots.add_entity(newEntity.eid, newEntity.x, newEntity.y, newEntity.ori);
+    if (remoteGhosts.size() <= newEntity.eid)
+      remoteGhosts.resize(size_t(newEntity.eid) + 1);
+    remoteGhosts[newEntity.eid].reset(newEntity);
   }
 }
 
+// a player left, its eid is free for the next one to join
+void on_remove_entity(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  deserialize_remove_entity(packet, eid);
+  if (!entities.remove_at(eid))
+    return;
+  if (eid < remoteGhosts.size())
+    remoteGhosts[eid].invalidate();
+}
+
 void on_set_controlled_entity(ENetPacket *packet)
 {
   deserialize_set_controlled_entity(packet, my_entity);
 }
 
-void on_snapshot(ENetPacket *packet)
+void apply_snapshot(const Entity &state)
 {
-  uint16_t eid = invalid_entity;
-  uint32_t tick = 0;
-  float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori, tick);
+  const uint16_t eid = state.eid;
+  const uint32_t tick = state.last_tick;
+  const float x = state.x; const float y = state.y; const float ori = state.ori;
 
   if (eid != my_entity) {
-    auto t = enet_time_get() + OFFSET;
-    snapshots[eid].push_back({t, x, y, ori});
+    // unsequenced, so it may come after the entity was removed
+    if (!entities.contains(eid))
+      return;
+    if (remoteGhosts.size() <= eid)
+      remoteGhosts.resize(size_t(eid) + 1);
+    // a late one doesn't replace a newer state
+    if (!remoteGhosts[eid].valid() || tick >= remoteGhosts[eid].sent_tick())
+      remoteGhosts[eid].reset(state);
+    snapshots.store(tick, eid, x, y, ori);
   }
   else {
-    if (snapshotsHistory.empty() or inputsHistory.empty())
+    // nothing predicted for that tick: from before we joined, older than the history, or ahead of us
+    // while on_tick is still getting the lead back
+    const TickSnapshot *predicted = predictedStates.find(tick);
+    Entity *e = entities.find(my_entity);
+    if (!predicted || !e || tick > e->last_tick)
       return;
 
-    clear_history(tick - 1);
-    auto last_snap = snapshotsHistory.front();
+    const float dx = x - predicted->x;
+    const float dy = y - predicted->y;
+    const float dori = ori - predicted->ori;
+    const float posError = sqrtf(dx * dx + dy * dy);
+    const float oriError = fabsf(dori);
+    if (posError <= reconcilePolicy.ignoreDistance && oriError <= reconcilePolicy.ignoreAngle)
+      return;
 
-    if (last_snap.x != x or last_snap.y != y or last_snap.ori != ori) {
-      TickSnapshot snap = {tick, x, y, ori};
-      resimulate_entity(snap, entities[my_entity]);
+    reconcileStats.totalError += posError;
+    if (posError > reconcilePolicy.resimDistance || oriError > reconcilePolicy.resimAngle) {
+      TickSnapshot snap = {tick, x, y, ori, state.speed};
+      resimulate_entity(snap, *e);
+      renderOffset = RenderOffset();
+      reconcileStats.resimulated++;
+    }
+    else {
+      shift_prediction(tick, dx, dy, dori, *e);
+      reconcileStats.blended++;
     }
   }
 }
 
+void on_snapshot(ENetPacket *packet)
+{
+  static std::vector<Entity> states;
+  uint32_t tick = 0;
+  if (!deserialize_snapshot(packet, tick, states))
+    return;
+  jitterBuffer.add_sample(enet_time_get(), tick);
+  for (const Entity &state : states)
+    apply_snapshot(state);
+}
+
+// the server sent what strayed from its extrapolation, everything else is where our ghost of it is
+void on_tick(ENetPacket *packet, uint32_t rtt_ms)
+{
+  uint32_t tick = 0;
+  deserialize_tick(packet, tick);
+  jitterBuffer.add_sample(enet_time_get(), tick);
+  if (const Entity *e = entities.find(my_entity))
+  {
+    const uint32_t targetTick = tick + static_cast<uint32_t>(rtt_ms / (DT * 1000)) + PREDICTION_LEAD_TICKS;
+    const int32_t drift = static_cast<int32_t>(targetTick - e->last_tick);
+    predictionDrift = abs(drift) > int32_t(PREDICTION_DRIFT_TOLERANCE) ? drift : 0;
+  }
+  for (uint16_t eid = 0; eid < remoteGhosts.size(); ++eid)
+  {
+    DeadReckoning &dr = remoteGhosts[eid];
+    if (eid == my_entity || !dr.valid() || dr.ghost().last_tick >= tick)
+      continue;
+    dr.advance_to(tick);
+    snapshots.store(tick, eid, dr.ghost().x, dr.ghost().y, dr.ghost().ori);
+  }
+}
+
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
@@ -120,6 +228,7 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet client\n");
     return 1;
   }
+  apply_host_options(client, argc, argv);
 
   ENetAddress address;
   enet_address_set_host(&address, "localhost");
@@ -157,12 +266,16 @@ int main(int argc, const char **argv)
 
   bool connected = false;
   uint32_t prev_time = enet_time_get();
+  double unsimulated_ms = 0.0; // the part of a tick left over from the last frame
+  uint32_t reconcileStatsTime = prev_time;
 
   while (!WindowShouldClose())
   {
 
     ENetEvent event;
     uint32_t cur_time = enet_time_get();
+    const uint32_t frame_ms = cur_time - prev_time;
+    prev_time = cur_time;
 
     while (enet_host_service(client, &event, 0) > 0)
     {
@@ -185,6 +298,12 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SNAPSHOT:
           on_snapshot(event.packet);
           break;
+        case E_SERVER_TO_CLIENT_TICK:
+          on_tick(event.packet, serverPeer->roundTripTime);
+          break;
+        case E_SERVER_TO_CLIENT_REMOVE_ENTITY:
+          on_remove_entity(event.packet);
+          break;
         };
         enet_packet_destroy(event.packet);
         break;
@@ -198,34 +317,52 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
-
-          e.thr = thr;
-          e.steer = steer;
-
-          auto dt_count = static_cast<uint32_t>(static_cast<float>(cur_time - prev_time) / (DT * 1000));
-          prev_time += cur_time - prev_time;
+      jitterBuffer.advance(cur_time);
+      const double renderTick = jitterBuffer.render_tick(cur_time);
+      if (Entity *e = entities.find(my_entity))
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
 
-          for (uint32_t t = 0; t < dt_count; t++) {
-            simulate_entity(e, DT);
-            e.last_tick++;
-            snapshotsHistory.push_back({e.last_tick, e.x, e.y, e.ori});
-            inputsHistory.push_back({e.last_tick, e.thr, e.steer});
-          }
+        e->thr = thr;
+        e->steer = steer;
 
-          // Send
-          send_entity_input(serverPeer, e.eid, e.thr, e.steer);
+        unsimulated_ms += frame_ms;
+        auto dt_count = static_cast<uint32_t>(unsimulated_ms / (DT * 1000));
+        unsimulated_ms -= dt_count * (DT * 1000);
+        if (predictionDrift > 0)
+        {
+          ++dt_count;
+          --predictionDrift;
         }
-        else
+        else if (predictionDrift < 0 && dt_count > 0)
         {
-          interpolate_entity(e, cur_time);
+          --dt_count;
+          ++predictionDrift;
+        }
+
+        for (uint32_t t = 0; t < dt_count; t++) {
+          simulate_entity(*e, DT);
+          e->last_tick++;
+          predictedStates.store(e->last_tick, {e->last_tick, e->x, e->y, e->ori, e->speed});
+          predictedInputs.store(e->last_tick, {e->last_tick, e->thr, e->steer});
         }
+
+        decay_render_offset(GetFrameTime());
+
+        // Send
+        send_entity_input(serverPeer, e->eid, e->thr, e->steer);
+      }
+      if (jitterBuffer.ready())
+        interpolate_entities(renderTick);
+    }
+
+    if (cur_time - reconcileStatsTime >= 1000)
+    {
+      shownReconcileStats = reconcileStats;
+      reconcileStats = ReconcileStats();
+      reconcileStatsTime = cur_time;
     }
 
     BeginDrawing();
@@ -233,11 +370,17 @@ int main(int argc, const char **argv)
       BeginMode2D(camera);
         for (const Entity &e : entities)
         {
-          const Rectangle rect = {e.x, e.y, 3.f, 1.f};
-          DrawRectanglePro(rect, {0.f, 0.5f}, e.ori * 180.f / PI, GetColor(e.color));
+          const RenderOffset offset = e.eid == my_entity ? renderOffset : RenderOffset();
+          const Rectangle rect = {e.x + offset.x, e.y + offset.y, 3.f, 1.f};
+          DrawRectanglePro(rect, {0.f, 0.5f}, (e.ori + offset.ori) * 180.f / PI, GetColor(e.color));
         }
 
       EndMode2D();
+      const uint32_t corrections = shownReconcileStats.blended + shownReconcileStats.resimulated;
+      DrawText(TextFormat("resim %u/s, blend %u/s, avg error %.3f", shownReconcileStats.resimulated,
+                          shownReconcileStats.blended, corrections ? shownReconcileStats.totalError / corrections : 0.f),
+               10, 10, 20, BLACK);
+      DrawText(TextFormat("interpolation delay %.0f ms", jitterBuffer.delay_ms()), 10, 35, 20, BLACK);
     EndDrawing();
   }
 
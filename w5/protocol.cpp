@@ -1,63 +1,101 @@
 #include "protocol.h"
+#include "net_send.h"
+#include "message_schema.h"
+#include "varint.h"
+#include <algorithm>
+
+typedef MessageSchema<E_CLIENT_TO_SERVER_JOIN> JoinMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_NEW_ENTITY, RawField<Entity>> NewEntityMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, Field<uint16_t>> SetControlledEntityMsg;
+typedef MessageSchema<E_CLIENT_TO_SERVER_INPUT, Field<uint16_t>, Field<float>, Field<float>> EntityInputMsg;
+// Aggregated snapshot: tick and entity count, the ascending eids as one batch (varint.h, delta coded, so
+// 1 byte and 2 bits an entity for gaps below 256), then x, y, ori, speed, thr, steer of every entity.
+// Full floats, the client's extrapolation has to match the server's bit for bit.
+typedef MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint32_t>, Field<uint16_t>> SnapshotHeaderMsg;
+typedef Field<float> SnapshotFloatField;
+constexpr size_t snapshot_entity_float_bytes = 6 * sizeof(float);
+typedef MessageSchema<E_SERVER_TO_CLIENT_TICK, Field<uint32_t>> TickMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_REMOVE_ENTITY, Field<uint16_t>> RemoveEntityMsg;
 
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  ENetPacket *packet = enet_packet_create(nullptr, JoinMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  JoinMsg::write(packet->data);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_NEW_ENTITY);
-  bs.write(ent);
+  ENetPacket *packet = enet_packet_create(nullptr, NewEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  NewEntityMsg::write(packet->data, ent);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY);
-  bs.write(eid);
+  ENetPacket *packet = enet_packet_create(nullptr, SetControlledEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  SetControlledEntityMsg::write(packet->data, eid);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   2 * sizeof(float),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_CLIENT_TO_SERVER_INPUT);
-  bs.write(eid);
-  bs.write(thr);
-  bs.write(steer);
-
-  enet_peer_send(peer, 1, packet);
+  ENetPacket *packet = enet_packet_create(nullptr, EntityInputMsg::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  EntityInputMsg::write(packet->data, eid, thr, steer);
+
+  net_send(peer, 1, packet);
+}
+
+void send_snapshot(ENetPeer *peer, uint32_t tick, const Entity *const *entities, size_t count)
+{
+  static thread_local std::vector<uint32_t> eids, scratch; // snapshots are encoded on job threads
+  for (size_t first = 0; first < count; first += SNAPSHOT_MAX_ENTITIES)
+  {
+    const size_t num = std::min(count - first, size_t(SNAPSHOT_MAX_ENTITIES));
+    const Entity *const *chunk = entities + first;
+    eids.resize(num);
+    scratch.resize(num);
+    for (size_t i = 0; i < num; ++i)
+      eids[i] = chunk[i]->eid;
+
+    const size_t maxBytes = SnapshotHeaderMsg::num_bytes + varint_batch_max_size(num) + num * snapshot_entity_float_bytes;
+    ENetPacket *packet = enet_packet_create(nullptr, maxBytes, ENET_PACKET_FLAG_UNSEQUENCED);
+    SnapshotHeaderMsg::write(packet->data, tick, static_cast<uint16_t>(num));
+    size_t size = SnapshotHeaderMsg::num_bytes;
+    size += encode_delta_batch(eids.data(), num, scratch.data(), packet->data + size);
+
+    Bitstream bs(packet->data + size, num * snapshot_entity_float_bytes);
+    for (size_t i = 0; i < num; ++i)
+    {
+      const Entity &e = *chunk[i];
+      for (float value : {e.x, e.y, e.ori, e.speed, e.thr, e.steer})
+        SnapshotFloatField::write(bs, value);
+    }
+    bs.flush();
+    enet_packet_resize(packet, size + bs.bytes_processed());
+
+    net_send(peer, 1, packet);
+  }
+}
+
+void send_tick(ENetPeer *peer, uint32_t tick)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, TickMsg::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  TickMsg::write(packet->data, tick);
+
+  net_send(peer, 1, packet);
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori, uint32_t tick)
+// reliable on the new entity channel, the removal can't overtake the entity's creation
+void send_remove_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   3 * sizeof(float) + sizeof(uint32_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_SNAPSHOT);
-  bs.write(eid);
-  bs.write(x);
-  bs.write(y);
-  bs.write(ori);
-  bs.write(tick);
-
-  enet_peer_send(peer, 1, packet);
+  ENetPacket *packet = enet_packet_create(nullptr, RemoveEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  RemoveEntityMsg::write(packet->data, eid);
+
+  net_send(peer, 0, packet);
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -67,39 +105,76 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(ent);
+  MessageView<NewEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  ent = view.get<0>();
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(eid);
+  MessageView<SetControlledEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
 }
 
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(eid);
-  bs.read(thr);
-  bs.read(steer);
+  MessageView<EntityInputMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
+  thr = view.get<1>();
+  steer = view.get<2>();
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori, uint32_t &tick)
+bool deserialize_snapshot(ENetPacket *packet, uint32_t &tick, std::vector<Entity> &states)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(eid);
-  bs.read(x);
-  bs.read(y);
-  bs.read(ori);
-  bs.read(tick);
+  static std::vector<uint32_t> eids;
+  MessageView<SnapshotHeaderMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return false;
+  tick = view.get<0>();
+  const uint16_t count = view.get<1>();
+
+  // the whole id list in one go, SSSE3 shuffles and a SIMD prefix sum when the build has them
+  eids.resize(count);
+  const uint8_t *idBlock = packet->data + SnapshotHeaderMsg::num_bytes;
+  const size_t idBytes = decode_delta_batch(idBlock, packet->dataLength - SnapshotHeaderMsg::num_bytes, count, eids.data());
+  if (count > 0 && idBytes == 0)
+    return false;
+  const size_t floatsOffset = SnapshotHeaderMsg::num_bytes + idBytes;
+  if (packet->dataLength - floatsOffset < count * snapshot_entity_float_bytes)
+    return false;
+
+  states.resize(count);
+  Bitstream bs(packet->data + floatsOffset, count * snapshot_entity_float_bytes);
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (eids[i] >= invalid_entity)
+      return false;
+    Entity &state = states[i];
+    state.eid = static_cast<uint16_t>(eids[i]);
+    for (float *value : {&state.x, &state.y, &state.ori, &state.speed, &state.thr, &state.steer})
+      SnapshotFloatField::read(bs, *value);
+    state.last_tick = tick;
+  }
+  return !bs.overflow();
 }
 
+void deserialize_tick(ENetPacket *packet, uint32_t &tick)
+{
+  MessageView<TickMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  tick = view.get<0>();
+}
+
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid)
+{
+  MessageView<RemoveEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <enet/enet.h>
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 #include "entity.h"
 #include "utilities.h"
 
@@ -10,19 +12,31 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
-  E_SERVER_TO_CLIENT_SNAPSHOT
+  E_SERVER_TO_CLIENT_SNAPSHOT,
+  E_SERVER_TO_CLIENT_TICK,
+  E_SERVER_TO_CLIENT_REMOVE_ENTITY
 };
 
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori, uint32_t tick);
+// The states and controls at tick, enough for the client to extrapolate them (dead_reckoning.h).
+// Every entity's last_tick has to be tick and their eids ascending; up to SNAPSHOT_MAX_ENTITIES go into
+// a packet, more are split over several.
+void send_snapshot(ENetPeer *peer, uint32_t tick, const Entity *const *entities, size_t count);
+// every send tick, whether any entity went out or not: clients extrapolate the rest up to it
+void send_tick(ENetPeer *peer, uint32_t tick);
+// the entity is gone for good, its eid may come back as a new one
+void send_remove_entity(ENetPeer *peer, uint16_t eid);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori, uint32_t &tick);
+// states come out with eid, the fields send_snapshot sends and last_tick = tick, false if it's malformed
+bool deserialize_snapshot(ENetPacket *packet, uint32_t &tick, std::vector<Entity> &states);
+void deserialize_tick(ENetPacket *packet, uint32_t &tick);
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid);
 
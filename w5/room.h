@@ -0,0 +1,40 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "entity.h"
+#include "entity_registry.h"
+#include "packet_batch.h"
+#include "room_scheduler.h"
+#include "dead_reckoning.h"
+
+// One match (room_scheduler.h): the cars of its players, the ghosts its clients extrapolate them with
+// and the peers playing it
+struct Room
+{
+  uint32_t id = 0;
+  EntityRegistry<Entity> entities{max_wire_entities};
+  std::map<uint16_t, ENetPeer*> controlledMap;
+  std::vector<ENetPeer*> peers;             // playing in it, in join order
+  uint32_t simTick = 0;                     // one per DT, every entity is simulated up to it
+  std::vector<DeadReckoning> deadReckoning; // what the room's clients extrapolate, by eid
+  std::vector<uint8_t> strayed;             // send tick scratch, by dense index
+  std::vector<ENetPeer*> owners;
+  std::vector<uint32_t> eidOrder;           // dense indices by ascending eid
+  uint64_t updatesDue = 0, updatesSent = 0; // entity updates per send tick, all of them vs past the tolerance
+  RoomClock clock;
+  PacketBatch outbox;                       // a slot per peer
+
+  bool awake() const { return !peers.empty(); }
+};
+
+// the world of a room nobody plays in anymore, the next match starts from scratch
+inline void reset_room(Room &room)
+{
+  room.entities = EntityRegistry<Entity>(max_wire_entities);
+  room.controlledMap.clear();
+  room.simTick = 0;
+  room.deadReckoning.clear();
+}
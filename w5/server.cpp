@@ -2,52 +2,229 @@
 #include <iostream>
 #include "entity.h"
 #include "protocol.h"
+#include "entity_registry.h"
+#include "host_options.h"
 #include "mathUtils.h"
+#include "tick_scheduler.h"
+#include "net_thread.h"
+#include "job_system.h"
+#include "packet_batch.h"
+#include "room.h"
 #include <stdlib.h>
+#include <memory>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include "utilities.h"
+#include "dead_reckoning.h"
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static std::vector<std::unique_ptr<Room>> rooms; // never shrinks, a room stays where it is
+static std::map<ENetPeer*, Room*> peerRooms;
+static uint32_t roomSize = 16; // players per room, --room-size
+static uint32_t sendRate = DEFAULT_SEND_RATE;
+static RoomScheduler<Room> scheduler(TPS);
+constexpr uint32_t metrics_report_interval = 10; // seconds
+static InputLatency inputLatency; // receive to the next room batch, for both threading models
+constexpr uint32_t simulation_grain = 1024; // entities per job
+constexpr uint32_t snapshot_peer_grain = 16; // peers per job
+constexpr uint32_t default_max_peers = 1024; // ENet allows up to 4095 per host
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host, uint32_t cur_tick)
+void on_join(ENetPacket *packet, ENetPeer *peer)
 {
+  if (peerRooms.contains(peer))
+    return;
+  Room &room = room_for_new_player(rooms, roomSize);
+
   // send all entities
-  for (const Entity &ent : entities)
+  for (const Entity &ent : room.entities)
     send_new_entity(peer, ent);
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
                    0x00000044 * (rand() % 5);
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
-  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid, cur_tick};
-  entities.push_back(ent);
+  EntityHandle handle = room.entities.create({color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, invalid_entity, room.simTick});
+  if (handle == invalid_handle)
+  {
+    printf("No free entity slot in room %u, join refused\n", room.id);
+    return;
+  }
+  if (!room.awake())
+    scheduler.wake(room);
+  room.peers.push_back(peer);
+  peerRooms[peer] = &room;
+  uint16_t newEid = handle_index(handle);
+  Entity &ent = *room.entities.get(handle);
+  ent.eid = newEid;
+
+  room.controlledMap[newEid] = peer;
 
-  controlledMap[newEid] = peer;
+  // the new client has new-entity states, not what the others were last sent: everyone gets a fresh one
+  if (room.deadReckoning.size() <= newEid)
+    room.deadReckoning.resize(size_t(newEid) + 1);
+  for (DeadReckoning &dr : room.deadReckoning)
+    dr.invalidate();
 
 
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  // send info about new entity to everyone in the room
+  for (ENetPeer *roomPeer : room.peers)
+    send_new_entity(roomPeer, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
 }
 
-void on_input(ENetPacket *packet)
+void on_leave(ENetPeer *peer)
+{
+  auto it = peerRooms.find(peer);
+  if (it == peerRooms.end())
+    return;
+  Room &room = *it->second;
+  peerRooms.erase(it);
+  room.peers.erase(std::find(room.peers.begin(), room.peers.end(), peer));
+  if (!room.awake())
+  {
+    reset_room(room);
+    return;
+  }
+
+  // the player's car leaves with it, everyone still in the room is told so
+  auto controlledIt = std::find_if(room.controlledMap.begin(), room.controlledMap.end(),
+                                   [peer](const auto &controlled) { return controlled.second == peer; });
+  if (controlledIt == room.controlledMap.end())
+    return;
+  const uint16_t eid = controlledIt->first;
+  room.controlledMap.erase(controlledIt);
+  room.entities.remove_at(eid);
+  room.deadReckoning[eid].invalidate();
+  for (ENetPeer *roomPeer : room.peers)
+    send_remove_entity(roomPeer, eid);
+}
+
+void on_input(Room &room, ENetPacket *packet)
 {
   uint16_t eid = invalid_entity;
   float thr = 0.f; float steer = 0.f;
   deserialize_entity_input(packet, eid, thr, steer);
-  entities[eid].thr = thr;
-  entities[eid].steer = steer;
+  if (Entity *e = room.entities.find(eid))
+  {
+    e->thr = thr;
+    e->steer = steer;
+  }
+}
+
+void handle_event(ENetHost *server, NetEvent &netEvent)
+{
+  ENetEvent &event = netEvent.event;
+  switch (event.type)
+  {
+  case ENET_EVENT_TYPE_CONNECT:
+    printf("Connection with %x:%u established\n", netEvent.address.host, netEvent.address.port);
+    break;
+  case ENET_EVENT_TYPE_DISCONNECT:
+    printf("Disconnected %x:%u \n", netEvent.address.host, netEvent.address.port);
+    on_leave(event.peer);
+    break;
+  case ENET_EVENT_TYPE_RECEIVE:
+    switch (get_packet_type(event.packet))
+    {
+      case E_CLIENT_TO_SERVER_JOIN:
+        on_join(event.packet, event.peer);
+        break;
+      case E_CLIENT_TO_SERVER_INPUT:
+        if (auto it = peerRooms.find(event.peer); it != peerRooms.end())
+          on_input(*it->second, event.packet);
+        break;
+    };
+    enet_packet_destroy(event.packet);
+    break;
+  default:
+    break;
+  };
+}
+
+// A room's due ticks and, when a send boundary is crossed, its snapshots, on a job thread. Nothing in
+// here touches another room, whatever it sends waits in room.outbox until the batch is over.
+void tick_room(Room &room, JobSystem &jobs)
+{
+  // MEANING: with variable dt on server and fixed dt on clients difference between simulations is too big
+  const uint32_t prevTick = room.simTick;
+  for (uint32_t t = 0; t < room.clock.dueTicks; ++t)
+  {
+    // every entity only moves itself, any split over threads gives the same floats
+    jobs.parallel_for(static_cast<uint32_t>(room.entities.size()), simulation_grain, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        Entity &e = room.entities.data()[i];
+        simulate_entity(e, DT);
+        e.last_tick++;
+      }
+    });
+    ++room.simTick;
+  }
+
+  // send when the tick counter crosses a send boundary, TPS / sendRate needn't be whole
+  if (uint64_t(room.simTick) * sendRate / TPS == uint64_t(prevTick) * sendRate / TPS)
+    return;
+
+  // what goes to whom is settled per entity first, then every peer's packets are encoded,
+  // in parallel when --sim-threads is above 1
+  room.strayed.assign(room.entities.size(), 0);
+  room.owners.assign(room.entities.size(), nullptr);
+  size_t idx = 0;
+  for (const Entity &e : room.entities)
+  {
+    DeadReckoning &dr = room.deadReckoning[e.eid];
+    // a ghost nothing was sent for yet may be ticks behind since the room woke up, reset replaces it anyway
+    if (dr.valid())
+      dr.advance_to(e.last_tick);
+    ++room.updatesDue;
+    if (dr.needs_update(e, VEHICLE_TOLERANCE))
+    {
+      dr.reset(e);
+      room.strayed[idx] = 1;
+      ++room.updatesSent;
+    }
+    auto ownerIt = room.controlledMap.find(e.eid);
+    room.owners[idx++] = ownerIt != room.controlledMap.end() ? ownerIt->second : nullptr;
+  }
+  // a snapshot's eids go out ascending, delta coded
+  room.eidOrder.resize(room.entities.size());
+  for (uint32_t j = 0; j < room.eidOrder.size(); ++j)
+    room.eidOrder[j] = j;
+  const Entity *es = room.entities.data();
+  std::sort(room.eidOrder.begin(), room.eidOrder.end(), [es](uint32_t a, uint32_t b) { return es[a].eid < es[b].eid; });
+
+  room.outbox.resize(room.peers.size());
+  jobs.parallel_for(static_cast<uint32_t>(room.peers.size()), snapshot_peer_grain, [&](uint32_t begin, uint32_t end) {
+    thread_local std::vector<const Entity*> toSend;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      ENetPeer *peer = room.peers[i];
+      PacketCapture capture(room.outbox, i);
+      // the owner reconciles its prediction against every one of them
+      toSend.clear();
+      for (uint32_t j : room.eidOrder)
+        if (room.strayed[j] || room.owners[j] == peer)
+          toSend.push_back(&es[j]);
+      send_snapshot(peer, room.simTick, toSend.data(), toSend.size());
+      send_tick(peer, room.simTick);
+    }
+  });
+}
+
+// single-threaded: blocks for up to timeout_ms until something arrives, then handles everything queued
+void service_network(ENetHost *server, uint32_t timeout_ms)
+{
+  ENetEvent event;
+  while (enet_host_service(server, &event, timeout_ms) > 0)
+  {
+    timeout_ms = 0;
+    NetEvent netEvent = make_net_event(event, tick_clock::now_ns());
+    inputLatency.received(netEvent.recvNs);
+    handle_event(server, netEvent);
+  }
 }
 
 int main(int argc, const char **argv)
@@ -62,68 +239,78 @@ int main(int argc, const char **argv)
   address.host = ENET_HOST_ANY;
   address.port = 10131;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  // --max-peers N: every player of every room is a peer of this one host
+  const uint32_t maxPeers = std::clamp(option_value(argc, argv, "--max-peers", default_max_peers), 1u, uint32_t(ENET_PROTOCOL_MAXIMUM_PEER_ID));
+  ENetHost *server = enet_host_create(&address, maxPeers, 2, 0, 0);
 
   if (!server)
   {
     printf("Cannot create ENet server\n");
     return 1;
   }
+  apply_host_options(server, argc, argv);
+  roomSize = std::max(option_value(argc, argv, "--room-size", roomSize), 1u);
+  printf("Up to %u peers in rooms of %u players\n", maxPeers, roomSize);
+
+  // --single-thread: ENet is serviced on the simulation thread between ticks, for comparing the two
+  const bool singleThread = has_option(argc, argv, "--single-thread");
+  NetThread net(server);
+  if (!singleThread)
+    net.start();
+  auto service = [&](uint32_t timeout_ms) {
+    if (singleThread)
+      service_network(server, timeout_ms);
+    else
+      net.service(timeout_ms, [&](NetEvent &e) { inputLatency.received(e.recvNs); handle_event(server, e); });
+  };
+
+  // --sim-threads N (0 is one per core), 1 by default: the parallel path hasn't been shown to scale on
+  // real cores yet. Simulation results don't depend on it.
+  JobSystem jobs(option_value(argc, argv, "--sim-threads", 1));
+  printf("Simulating on %u threads\n", jobs.thread_count());
+
+  sendRate = std::clamp(option_value(argc, argv, "--send-rate", DEFAULT_SEND_RATE), 1u, TPS);
+  printf("Simulating at %u Hz, sending snapshots at %u Hz\n", TPS, sendRate);
 
-  uint32_t lastTime = enet_time_get();
+  int64_t lastReportNs = tick_clock::now_ns();
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-    auto curTick = static_cast<uint32_t>(static_cast<float>(curTime) / (DT * 1000));
-
-    ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
+    const std::vector<Room*> &due = scheduler.wait(rooms, service);
+    inputLatency.tick_started(scheduler.batch_start_ns());
+    if (!due.empty())
     {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server, curTick);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            on_input(event.packet);
-            break;
-        };
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
+      // a room per job, the workers steal whole rooms from each other and the chunks inside the big ones
+      jobs.parallel_for(static_cast<uint32_t>(due.size()), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i)
+          tick_room(*due[i], jobs);
+      });
+      for (Room *room : due)
+        room->outbox.send_all();
+      net_flush(server);
     }
-    for (Entity &e : entities)
-    {
-      auto dt_count = static_cast<uint32_t>(static_cast<float>(curTime - lastTime) / (DT * 1000));
-
-      // simulate
-      // MEANING: with variable dt on server and fixed dt on clients difference between simulations is too big
-      for (uint32_t t = 0; t < dt_count; t++) {
-        simulate_entity(e, DT);
-        e.last_tick++;
-      }
+    scheduler.batch_done();
 
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
+    if (scheduler.batch_start_ns() - lastReportNs >= int64_t(metrics_report_interval) * 1'000'000'000)
+    {
+      lastReportNs = scheduler.batch_start_ns();
+      const size_t awake = std::count_if(rooms.begin(), rooms.end(), [](const std::unique_ptr<Room> &room) { return room->awake(); });
+      print_room_metrics(scheduler.metrics(), awake, rooms.size());
+      scheduler.reset_metrics();
+      inputLatency.print();
+      inputLatency.reset();
+      if (!singleThread)
+        net.print_metrics();
+      uint64_t updatesDue = 0, updatesSent = 0;
+      for (const std::unique_ptr<Room> &room : rooms)
       {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori, e.last_tick);
+        updatesDue += room->updatesDue;
+        updatesSent += room->updatesSent;
+        room->updatesDue = room->updatesSent = 0;
       }
+      if (updatesDue > 0)
+        printf("entity updates sent: %llu of %llu (%.1f%%)\n", (unsigned long long)updatesSent,
+               (unsigned long long)updatesDue, 100.0 * updatesSent / updatesDue);
     }
-    lastTime += curTime - lastTime;
-
-    enet_host_flush(server);
-    usleep(SERVER_USLEEP);
   }
 
   enet_host_destroy(server);
@@ -131,5 +318,3 @@ int main(int argc, const char **argv)
   atexit(enet_deinitialize);
   return 0;
 }
-
-
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "utilities.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define INTERPOLATION_SSE2 1
+#endif
+
+// Remote entity history as SoA frames: one frame per server tick with the x, y and ori of every
+// entity, indexed by eid. All entities come in the same ticks, so the two frames around the render
+// tick and the blend factor are found once, and the interpolation is one pass over flat arrays.
+
+const uint32_t SNAPSHOT_FRAMES = 32;
+const float MAX_EXTRAPOLATION_TICKS = TPS / 10.f; // 100 ms past the newest snapshot, then it holds
+
+// out = a + t * (b - a) over count floats
+inline void lerp_batch(const float *a, const float *b, float t, size_t count, float *out)
+{
+  size_t i = 0;
+#if defined(INTERPOLATION_SSE2)
+  const __m128 t4 = _mm_set1_ps(t);
+  for (const size_t simdCount = count & ~size_t(3); i < simdCount; i += 4)
+  {
+    const __m128 a4 = _mm_loadu_ps(a + i);
+    _mm_storeu_ps(out + i, _mm_add_ps(a4, _mm_mul_ps(t4, _mm_sub_ps(_mm_loadu_ps(b + i), a4))));
+  }
+#endif
+  for (; i < count; ++i)
+    out[i] = a[i] + t * (b[i] - a[i]);
+}
+
+// angles along the shorter arc: the difference is wrapped into [-pi, pi] first
+inline void lerp_angle_batch(const float *a, const float *b, float t, size_t count, float *out)
+{
+  constexpr float twoPi = 6.283185307f;
+  constexpr float invTwoPi = 1.f / twoPi;
+  size_t i = 0;
+#if defined(INTERPOLATION_SSE2)
+  const __m128 t4 = _mm_set1_ps(t);
+  for (const size_t simdCount = count & ~size_t(3); i < simdCount; i += 4)
+  {
+    const __m128 a4 = _mm_loadu_ps(a + i);
+    __m128 d = _mm_sub_ps(_mm_loadu_ps(b + i), a4);
+    const __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(d, _mm_set1_ps(invTwoPi)))); // round to nearest
+    d = _mm_sub_ps(d, _mm_mul_ps(turns, _mm_set1_ps(twoPi)));
+    _mm_storeu_ps(out + i, _mm_add_ps(a4, _mm_mul_ps(t4, d)));
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    float d = b[i] - a[i];
+    d -= twoPi * std::nearbyint(d * invTwoPi);
+    out[i] = a[i] + t * d;
+  }
+}
+
+class SnapshotFrames {
+public:
+  // first state of an entity, written into every frame so it holds there until its snapshots come
+  void add_entity(uint16_t eid, float x, float y, float ori) {
+    reserve_column(eid);
+    for (Frame &frame : frames_)
+      write(frame, eid, x, y, ori);
+    write(out_, eid, x, y, ori);
+  }
+
+  // A tick newer than all we have starts a frame as a copy of the newest one, so an entity whose
+  // snapshot got lost holds its position. Older ticks go into their frame if it's still there.
+  void store(uint32_t tick, uint16_t eid, float x, float y, float ori) {
+    reserve_column(eid);
+    if (count_ == 0 || tick > at(count_ - 1).tick)
+    {
+      uint32_t slot = head_;
+      if (count_ < SNAPSHOT_FRAMES)
+        slot = (head_ + count_++) % SNAPSHOT_FRAMES;
+      else
+        head_ = (head_ + 1) % SNAPSHOT_FRAMES; // the oldest frame is reused
+      Frame &frame = frames_[slot];
+      if (count_ > 1)
+        frame.values = at(count_ - 2).values;
+      frame.tick = tick;
+      write(frame, eid, x, y, ori);
+      return;
+    }
+    for (uint32_t i = count_; i > 0; --i)
+      if (at(i - 1).tick == tick)
+      {
+        write(at(i - 1), eid, x, y, ori);
+        return;
+      }
+  }
+
+  // every entity at render_tick, interpolated between the frames around it, extrapolated for a bit past the newest
+  bool sample(double render_tick) {
+    if (count_ == 0)
+      return false;
+
+    const Frame &newest = at(count_ - 1);
+    if (render_tick >= newest.tick)
+    {
+      if (count_ == 1)
+        return blend(newest, newest, 0.f);
+      const Frame &prev = at(count_ - 2);
+      const float extra = std::fmin(static_cast<float>(render_tick - newest.tick), MAX_EXTRAPOLATION_TICKS);
+      return blend(prev, newest, 1.f + extra / static_cast<float>(newest.tick - prev.tick));
+    }
+    for (uint32_t i = count_ - 1; i > 0; --i)
+    {
+      const Frame &prev = at(i - 1);
+      if (prev.tick <= render_tick)
+      {
+        const Frame &next = at(i);
+        return blend(prev, next, static_cast<float>((render_tick - prev.tick) / (next.tick - prev.tick)));
+      }
+    }
+    return blend(at(0), at(0), 0.f); // render tick is older than all we have
+  }
+
+  // results of the last sample(), indexed by eid
+  const float *xs() const { return out_.values.data(); }
+  const float *ys() const { return out_.values.data() + stride_; }
+  const float *oris() const { return out_.values.data() + 2 * stride_; }
+
+private:
+  struct Frame
+  {
+    uint32_t tick = 0;
+    std::vector<float> values; // x[stride], y[stride], ori[stride]
+  };
+
+  Frame &at(uint32_t i) { return frames_[(head_ + i) % SNAPSHOT_FRAMES]; }
+  const Frame &at(uint32_t i) const { return frames_[(head_ + i) % SNAPSHOT_FRAMES]; }
+
+  void write(Frame &frame, uint16_t eid, float x, float y, float ori) const {
+    frame.values[eid] = x;
+    frame.values[stride_ + eid] = y;
+    frame.values[2 * stride_ + eid] = ori;
+  }
+
+  // columns grow in steps of 64 entities, each component keeps its own contiguous run
+  void reserve_column(uint16_t eid) {
+    if (eid < stride_)
+      return;
+    const size_t newStride = (size_t(eid) + 64) & ~size_t(63);
+    auto regrow = [&](Frame &frame) {
+      std::vector<float> values(3 * newStride, 0.f);
+      if (!frame.values.empty())
+        for (size_t c = 0; c < 3; ++c)
+          std::copy_n(frame.values.begin() + c * stride_, stride_, values.begin() + c * newStride);
+      frame.values = std::move(values);
+    };
+    for (Frame &frame : frames_)
+      regrow(frame);
+    regrow(out_);
+    stride_ = newStride;
+  }
+
+  bool blend(const Frame &a, const Frame &b, float t) {
+    lerp_batch(a.values.data(), b.values.data(), t, 2 * stride_, out_.values.data());
+    lerp_angle_batch(a.values.data() + 2 * stride_, b.values.data() + 2 * stride_, t, stride_,
+                     out_.values.data() + 2 * stride_);
+    return true;
+  }
+
+  std::vector<Frame> frames_ = std::vector<Frame>(SNAPSHOT_FRAMES);
+  Frame out_;
+  size_t stride_ = 0;
+  uint32_t head_ = 0;
+  uint32_t count_ = 0;
+};
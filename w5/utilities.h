@@ -1,20 +1,18 @@
 #pragma once
 
-#include <cstring>
+#include <array>
+#include <cstdint>
+#include "bitstream.h"
 
 const uint32_t TPS = 128; //ticks per second (on clients)
 const float DT = 1.0f / TPS; // TPS=128 -> DT=0.0078 sec
 
-const uint32_t SERVER_USLEEP = 100'000; //mks
-const uint32_t OFFSET = SERVER_USLEEP * 0.0011; //ms
+// snapshots per second, the server ticks at TPS and sends every TPS / rate ticks on average.
+// --send-rate N on the server picks another one, clients adapt their delay to it.
+const uint32_t DEFAULT_SEND_RATE = 10;
 
-struct Snapshot {
-  uint32_t time;
-
-  float x;
-  float y;
-  float ori;
-};
+// entities in one snapshot packet, ~1.2 KB at most so it stays below the MTU
+const uint32_t SNAPSHOT_MAX_ENTITIES = 48;
 
 struct TickSnapshot {
   uint32_t tick;
@@ -22,6 +20,7 @@ struct TickSnapshot {
   float x;
   float y;
   float ori;
+  float speed;
 };
 
 struct TickInput {
@@ -31,26 +30,62 @@ struct TickInput {
   float steer;
 };
 
-class Bitstream {
+// Client prediction history: a slot per tick, tick % capacity, so lookups by tick are O(1) and
+// old ticks are overwritten instead of erased. 256 ticks is 2 s at TPS=128, longer than any RTT
+// we'd still predict over.
+const uint32_t PREDICTION_HISTORY_SIZE = 256;
+
+// The client predicts its own entity ahead of the server: an RTT past the newest server tick it heard
+// of (half for that tick to get here, half for our input to get there) plus a margin for jitter, so the
+// server's state for a tick arrives after we predicted it. Off by more than the tolerance, a tick per
+// frame is simulated extra or skipped until the lead is back.
+const uint32_t PREDICTION_LEAD_TICKS = 4;
+const uint32_t PREDICTION_DRIFT_TOLERANCE = 2;
+
+template <typename T, uint32_t Capacity>
+class TickRing {
 public:
-  explicit Bitstream(uint8_t* data_ptr)
-    : data_ptr_(data_ptr),
-      data_offset_(0) {
+  void store(uint32_t tick, const T &value) {
+    const uint32_t slot = tick % Capacity;
+    values_[slot] = value;
+    ticks_[slot] = tick;
+    valid_[slot] = true;
   }
 
-  template <typename Type>
-  void write(const Type& data) {
-    memcpy(data_offset_ + data_ptr_, reinterpret_cast<const uint8_t*>(&data), sizeof(Type));
-    data_offset_ += sizeof(Type);
+  // nullptr if the tick was never stored or its slot went to a newer one
+  const T *find(uint32_t tick) const {
+    const uint32_t slot = tick % Capacity;
+    return valid_[slot] && ticks_[slot] == tick ? &values_[slot] : nullptr;
   }
-
-  template <typename Type>
-  void read(Type& data) {
-    memcpy(reinterpret_cast<uint8_t*>(&data), data_offset_ + data_ptr_, sizeof(Type));
-    data_offset_ += sizeof(Type);
+  T *find(uint32_t tick) {
+    const uint32_t slot = tick % Capacity;
+    return valid_[slot] && ticks_[slot] == tick ? &values_[slot] : nullptr;
   }
 
+  static constexpr uint32_t capacity() { return Capacity; }
+
 private:
-  uint8_t* data_ptr_;
-  uint32_t data_offset_;
-};
\ No newline at end of file
+  std::array<T, Capacity> values_{};
+  std::array<uint32_t, Capacity> ticks_{};
+  std::array<bool, Capacity> valid_{};
+};
+
+// How the client treats a server state that disagrees with its prediction for the same tick.
+// Up to the ignore thresholds it's float noise, up to the resim ones the prediction is shifted by the
+// error and the drawn entity catches up over blendTime, past them inputs are replayed and the entity snaps.
+struct ReconcilePolicy
+{
+  float ignoreDistance = 0.001f;
+  float ignoreAngle = 0.001f; // rad
+  float resimDistance = 0.5f;
+  float resimAngle = 0.1f; // rad
+  float blendTime = 0.1f; // sec
+};
+
+// counted over a window to tune the thresholds, CPU (resimulations) against accuracy (errors)
+struct ReconcileStats
+{
+  uint32_t blended = 0;
+  uint32_t resimulated = 0;
+  float totalError = 0.f; // position error of both
+};
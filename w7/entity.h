@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include "world_cell.h"
 
 constexpr uint16_t invalid_entity = -1;
 struct Entity
@@ -12,6 +13,8 @@ struct Entity
   float thr = 0.f;
   float steer = 0.f;
   uint16_t eid = invalid_entity;
+  WorldCell cell;
+  uint8_t cellGen = 0; // bumped on every cell change
 };
 
 void simulate_entity(Entity &e, float dt);
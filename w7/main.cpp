@@ -9,24 +9,32 @@
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "entity_registry.h"
+#include "host_options.h"
 #include "quantisation.h"
+#include "varint.h"
+#include "sequence.h"
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
 
 static uint16_t cur_input_id = 0;
 static InputHistory localInputHistory;
 
+static UpstreamBundle upstream; // sent once per frame
+static EntityTickFilter snapshotTicks;
+static SnapshotHistory snapshotHistory;
+static uint16_t lastCodedSeq = 0;
+static bool hasCodedSnapshot = false;
+
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.emplace_at(newEntity.eid, newEntity);
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -34,24 +42,84 @@ void on_set_controlled_entity(ENetPacket *packet)
   deserialize_set_controlled_entity(packet, my_entity);
 }
 
-void on_input_ack(ENetPacket* packet, uint16_t& ref_id)
+void on_input_ack(ENetPacket* packet)
 {
+  uint16_t ref_id = 0;
   deserialize_input_ack(packet, ref_id);
+  if (!sequence_greater(ref_id, localInputHistory.reference_id))
+    return;
+  localInputHistory.reference_id = ref_id;
+  // the server has everything up to ref_id, no need to repeat it
+  std::erase_if(localInputHistory.inputHistory, [ref_id](const Input &input) {
+    return !sequence_greater(input.id, ref_id);
+  });
+}
+
+void on_entity_cell(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  WorldCell cell;
+  uint8_t cellGen = 0;
+  deserialize_entity_cell(packet, eid, cell, cellGen);
+  if (Entity *e = entities.find(eid))
+  {
+    e->cell = cell;
+    e->cellGen = cellGen;
+  }
 }
 
 void on_snapshot(ENetPacket *packet)
 {
   uint16_t eid = invalid_entity;
+  uint16_t tick = 0;
+  uint8_t cellGenParity = 0;
   float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  if (!deserialize_snapshot(packet, eid, tick, cellGenParity, x, y, ori))
+    return;
+  Entity *e = entities.find(eid);
+  // offset from a cell we haven't been told about yet (or an old one), can't place it
+  if (!e || cellGenParity != (e->cellGen & 1))
+    return;
+  if (!snapshotTicks.accept(eid, tick))
+    return;
+  e->x = cell_origin_x(e->cell) + x;
+  e->y = cell_origin_y(e->cell) + y;
+  e->ori = ori;
+}
+
+void on_coded_snapshot(ENetPacket *packet)
+{
+  uint16_t seq = 0;
+  const SnapshotCodingState *state = deserialize_coded_snapshot(packet, snapshotHistory, seq);
+  if (!state)
+    return;
+  // acked even when it's late, the server may use it as a baseline
+  send_snapshot_ack(upstream, seq);
+  if (hasCodedSnapshot && !sequence_greater(seq, lastCodedSeq))
+    return;
+  lastCodedSeq = seq;
+  hasCodedSnapshot = true;
+
+  for (const QuantizedEntity &q : state->entities)
+  {
+    if (Entity *e = entities.find(q.eid))
     {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
+      PositionQuantized pos(static_cast<uint32_t>(q.x) << 10 | q.y);
+      e->cell = {q.cellX, q.cellY};
+      e->x = cell_origin_x(e->cell) + pos.get<0>();
+      e->y = cell_origin_y(e->cell) + pos.get<1>();
+      e->ori = OrientationQuantized(q.ori).get<0>();
     }
+  }
+}
+
+// a player left, its eid is free for the next one to join
+void on_remove_entity(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  deserialize_remove_entity(packet, eid);
+  if (entities.remove_at(eid))
+    snapshotTicks.reset(eid);
 }
 
 bool is_quantized_successfully(float x, float y, float lo, float hi, int num_bits)
@@ -62,40 +130,242 @@ bool is_quantized_successfully(float x, float y, float lo, float hi, int num_bit
 
 void testing()
 {
-  PackedFloat<uint8_t, 4> packedFloat1(0.1f, -1.f, 1.f);
-  auto unpackedFloat1 = packedFloat1.unpack(-1.f, 1.f);
+  float4bitsQuantized packedFloat1(0.1f);
+  auto unpackedFloat1 = packedFloat1.get<0>();
   assert(is_quantized_successfully(unpackedFloat1, 0.1f, -1.f, 1.f, 4));
 
-  PackedFloat2<uint16_t, 8, 8> packedFloat2({4.f, -5.f}, {-10.f, -10.f}, {10.f, 10.f});
-  auto unpackedFloat2 = packedFloat2.unpack({-10.f, -10.f}, {10.f, 10.f});
-  assert(is_quantized_successfully(unpackedFloat2.x, 4.f, -10.f, 10.f, 8));
-  assert(is_quantized_successfully(unpackedFloat2.y, -5.f, -10.f, 10.f, 8));
-
-  PackedFloat3<uint32_t, 11, 10, 11> packedFloat3({0.1f, -0.2f, 0.3f}, {-1.f, -1.f, -1.f}, {1.f, 1.f, 1.f});
-  auto unpackedFloat3 = packedFloat3.unpack({-1.f, -1.f, -1.f}, {1.f, 1.f, 1.f});
-  assert(is_quantized_successfully(unpackedFloat3.x, 0.1f, -1.f, 1.f, 11));
-  assert(is_quantized_successfully(unpackedFloat3.y, -0.2f, -1.f, 1.f, 10));
-  assert(is_quantized_successfully(unpackedFloat3.z, 0.3f, -1.f, 1.f, 11));
+  PackedFloatN<uint16_t, QuantRange{8, -10.f, 10.f}, QuantRange{8, -10.f, 10.f}> packedFloat2({4.f, -5.f});
+  auto unpackedFloat2 = packedFloat2.unpack();
+  assert(is_quantized_successfully(unpackedFloat2[0], 4.f, -10.f, 10.f, 8));
+  assert(is_quantized_successfully(unpackedFloat2[1], -5.f, -10.f, 10.f, 8));
+
+  typedef PackedFloatN<uint32_t, QuantRange{11, -1.f, 1.f}, QuantRange{10, -1.f, 1.f}, QuantRange{11, -1.f, 1.f}> PackedFloat3;
+  PackedFloat3 packedFloat3({0.1f, -0.2f, 0.3f});
+  auto unpackedFloat3 = packedFloat3.unpack();
+  assert(is_quantized_successfully(unpackedFloat3[0], 0.1f, -1.f, 1.f, 11));
+  assert(is_quantized_successfully(unpackedFloat3[1], -0.2f, -1.f, 1.f, 10));
+  assert(is_quantized_successfully(unpackedFloat3[2], 0.3f, -1.f, 1.f, 11));
+  // the layout didn't change: x in the highest bits, z in the lowest
+  assert(packedFloat3.packedVal == (pack_float<uint32_t>(0.1f, -1.f, 1.f, 11) << 21 |
+                                    pack_float<uint32_t>(-0.2f, -1.f, 1.f, 10) << 11 |
+                                    pack_float<uint32_t>(0.3f, -1.f, 1.f, 11)));
+
+  // batch path must give the same bits as packing one by one, including the scalar tail and clamping
+  const float xs[] = {-20.f, -16.f, -3.3f, 0.f, 1.25f, 7.9f, 15.99f, 16.f, 40.f};
+  const float ys[] = {-9.f, -8.f, 5.5f, 0.f, -1.25f, 7.9f, -7.99f, 8.f, -0.1f};
+  const size_t batchSize = sizeof(xs) / sizeof(xs[0]);
+  uint32_t packedBatch[batchSize];
+  float xsUnpacked[batchSize], ysUnpacked[batchSize];
+  PositionQuantized::pack_batch(packedBatch, batchSize, xs, ys);
+  PositionQuantized::unpack_batch(packedBatch, batchSize, xsUnpacked, ysUnpacked);
+  for (size_t i = 0; i < batchSize; ++i)
+  {
+    PositionQuantized single({xs[i], ys[i]});
+    assert(packedBatch[i] == single.packedVal);
+    assert(xsUnpacked[i] == single.get<0>() && ysUnpacked[i] == single.get<1>());
+  }
 
   printf("Part1: Test passed successfully!\n");
 
-  auto* mem = (uint8_t *)malloc(sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t));
-  auto b1 = Bitstream(mem);
-  auto b2 = Bitstream(mem);
-  uint32_t val = 0;
+  const size_t memSize = 32;
+  auto* mem = (uint8_t *)malloc(memSize);
+  auto b1 = Bitstream(mem, memSize);
+  auto b2 = Bitstream(mem, memSize);
+
+  write_varint(b1, 111u);
+  write_varint(b1, 2222u);
+  write_varint(b1, 333444555u);
+  write_varint(b1, 5'000'000'000ull);
+  write_varint(b1, UINT64_MAX);
+  write_zigzag(b1, -5);
+  b1.flush();
+  assert(!b1.overflow() && b1.bytes_processed() == 1 + 2 + 5 + 5 + 9 + 1);
+
+  assert(read_varint(b2) == 111);
+  assert(read_varint(b2) == 2222);
+  assert(read_varint(b2) == 333444555);
+  assert(read_varint(b2) == 5'000'000'000ull);
+  assert(read_varint(b2) == UINT64_MAX);
+  assert(read_zigzag(b2) == -5);
+  free(mem);
+
+  printf("Part2: Test passed successfully!\n");
+
+  uint8_t bits[5] = {};
+  auto b3 = Bitstream(bits, sizeof(bits));
+  auto b4 = Bitstream(bits, sizeof(bits));
+  b3.write_bits(0x1fffff, 21);
+  b3.write_bits(0x5, 3);
+  b3.write_bits(0xabcd, 16);
+  b3.flush();
+  assert(b3.bytes_processed() == 5 && !b3.overflow());
+  b3.write_bits(1, 1);
+  assert(b3.overflow());
+
+  assert(b4.read_bits(21) == 0x1fffff);
+  assert(b4.read_bits(3) == 0x5);
+  assert(b4.read_bits(16) == 0xabcd);
+  b4.read_bits(1);
+  assert(b4.overflow());
+
+  printf("Part3: Test passed successfully!\n");
+
+  PrecisionPolicy policy;
+  assert(select_precision(policy, 0.f, 0.f, 3.f, 3.f) == E_PRECISION_FULL);
+  assert(select_precision(policy, 0.f, 0.f, 8.f, -6.f) == E_PRECISION_MEDIUM);
+  assert(select_precision(policy, 0.f, 0.f, 15.f, 7.f) == E_PRECISION_LOW);
+  for (uint32_t level = 0; level < E_PRECISION_LEVEL_COUNT; ++level)
+  {
+    const PrecisionDrop drop = precision_drop[level];
+    for (float x = -cell_offset_range_x; x <= cell_offset_range_x; x += 0.37f)
+    {
+      PositionQuantized full({x, x * 0.5f});
+      const uint32_t xCode = restore_precision(reduce_precision(full.packedVal >> 10, drop.x), drop.x);
+      const uint32_t yCode = restore_precision(reduce_precision(full.packedVal & 0x3ff, drop.y), drop.y);
+      PositionQuantized restored(xCode << 10 | yCode);
+      assert(is_quantized_successfully(restored.get<0>(), x, -cell_offset_range_x, cell_offset_range_x, 11 - drop.x));
+      assert(is_quantized_successfully(restored.get<1>(), x * 0.5f, -cell_offset_range_y, cell_offset_range_y, 10 - drop.y));
+    }
+  }
+
+  // cells switch only past the margin, far away positions keep the same offset precision
+  WorldCell cell = cell_of(0.f, 0.f);
+  assert(cell == WorldCell{});
+  assert(!update_cell(cell, 19.f, -9.f));
+  assert(update_cell(cell, 20.5f, 0.f) && cell == (WorldCell{1, 0}));
+  assert(!update_cell(cell, 14.f, 0.f)); // back over the border, still inside the grown box
+  assert(update_cell(cell, -1000.f, 500.f) && cell == (WorldCell{-31, 31}));
+  PositionQuantized farAway({-1000.f - cell_origin_x(cell), 500.f - cell_origin_y(cell)});
+  assert(is_quantized_successfully(cell_origin_x(cell) + farAway.get<0>(), -1000.f,
+                                   -cell_offset_range_x, cell_offset_range_x, 11));
+
+  printf("Part4: Test passed successfully!\n");
+
+  std::vector<uint8_t> coded(1024);
+  auto b5 = Bitstream(coded.data(), coded.size());
+  UintModel uintModel;
+  SintModel sintModel;
+  BitModel bitModel;
+  {
+    RangeEncoder rc(b5);
+    for (uint32_t i = 0; i < 200; ++i)
+    {
+      uintModel.encode(rc, i % 3 == 0 ? 0 : i * 1000003u);
+      sintModel.encode(rc, i % 2 ? -int32_t(i) : int32_t(i));
+      rc.encode_bit(bitModel, i % 7 == 0);
+    }
+    uintModel.encode(rc, 0xffffffff);
+    rc.flush();
+  }
+  b5.flush();
+  auto b6 = Bitstream(coded.data(), b5.bytes_processed());
+  uintModel = UintModel();
+  sintModel = SintModel();
+  bitModel = BitModel();
+  {
+    RangeDecoder rc(b6);
+    for (uint32_t i = 0; i < 200; ++i)
+    {
+      assert(uintModel.decode(rc) == (i % 3 == 0 ? 0 : i * 1000003u));
+      assert(sintModel.decode(rc) == (i % 2 ? -int32_t(i) : int32_t(i)));
+      assert(rc.decode_bit(bitModel) == (i % 7 == 0 ? 1u : 0u));
+    }
+    assert(uintModel.decode(rc) == 0xffffffff);
+    assert(!rc.overflow());
+  }
 
-  b1.write_packed_uint(111u);
-  b1.write_packed_uint(2222u);
-  b1.write_packed_uint(333444555u);
+  // both sides start from the acked state and end up with the same models and entities
+  std::vector<QuantizedEntity> frame = {{1, 100, 200, 250, 0, 0}, {4, 1000, 20, 3, -2, 7}, {5, 2047, 1023, 128, 0, 0}};
+  SnapshotHistory serverHistory, clientHistory;
+  for (uint16_t seq = 0; seq < 40; ++seq)
+  {
+    frame[0].x += 1;
+    frame[1].ori += 3; // wraps
+    if (seq == 10)
+      frame[0].cellX += 1;
+    if (seq == 20)
+      frame.push_back({9, 0, 0, 0, 100000, -3});
+    const bool hasBase = seq > 2;
+    const uint16_t baseSeq = seq - 2;
+    SnapshotCodingState empty, sent, received;
+    auto b7 = Bitstream(coded.data(), coded.size());
+    encode_snapshot_body(hasBase ? *serverHistory.find(baseSeq) : empty, frame.data(), frame.size(), b7, sent);
+    b7.flush();
+    auto b8 = Bitstream(coded.data(), b7.bytes_processed());
+    assert(decode_snapshot_body(hasBase ? *clientHistory.find(baseSeq) : empty, b8, received));
+    assert(received.entities.size() == frame.size());
+    for (size_t i = 0; i < frame.size(); ++i)
+      assert(received.entities[i].eid == frame[i].eid && received.entities[i].x == frame[i].x &&
+             received.entities[i].y == frame[i].y && received.entities[i].ori == frame[i].ori &&
+             received.entities[i].cellX == frame[i].cellX && received.entities[i].cellY == frame[i].cellY);
+    assert(memcmp(&sent.models, &received.models, sizeof(SnapshotModels)) == 0);
+    serverHistory.store(seq, std::move(sent));
+    clientHistory.store(seq, std::move(received));
+  }
 
-  b2.read_packed_uint(val);
-  assert(val == 111);
-  b2.read_packed_uint(val);
-  assert(val == 2222);
-  b2.read_packed_uint(val);
-  assert(val == 333444555);
+  printf("Part5: Test passed successfully!\n");
+
+  assert(sequence_greater(1, 0) && sequence_greater(2, 65535) && !sequence_greater(65535, 2));
+  assert(sequence_less(65000, 100) && sequence_diff(3, 65533) == 6);
+  EntityTickFilter tickFilter;
+  assert(tickFilter.accept(7, 65530));
+  assert(tickFilter.accept(7, 4));      // wrapped around
+  assert(!tickFilter.accept(7, 65534)); // late packet from before the wrap
+  assert(tickFilter.accept(7, 4));      // same tick again
+  assert(tickFilter.accept(3, 100));    // other entities have their own tick
+  tickFilter.reset(7);
+  assert(tickFilter.accept(7, 65534));
+
+  printf("Part6: Test passed successfully!\n");
+
+  // a held key is one run, the window survives the id wrap and comes out oldest first
+  std::deque<Input> sentInputs;
+  for (uint16_t i = 0; i < 40; ++i)
+    sentInputs.push_back({static_cast<uint16_t>(65520 + i), i < 30 ? 1.f : -1.f, i % 10 < 5 ? 0.f : 1.f});
+  UpstreamBundle bundle;
+  send_entity_input(bundle, 3, sentInputs);
+  send_snapshot_ack(bundle, 77);
+  ENetPacket bundlePacket = {};
+  bundlePacket.data = const_cast<uint8_t *>(bundle.data());
+  bundlePacket.dataLength = bundle.size();
+  std::vector<Input> receivedInputs;
+  uint16_t inputEid = invalid_entity, ackedSeq = 0;
+  assert(unpack_bundle(&bundlePacket, [&](ENetPacket *message) {
+    if (get_packet_type(message) == E_CLIENT_TO_SERVER_INPUT)
+      assert(deserialize_entity_input(message, inputEid, receivedInputs));
+    else
+      deserialize_snapshot_ack(message, ackedSeq);
+  }));
+  assert(inputEid == 3 && ackedSeq == 77 && receivedInputs.size() == input_window_size);
+  for (size_t i = 0; i < input_window_size; ++i)
+  {
+    const Input &sent = sentInputs[sentInputs.size() - input_window_size + i];
+    assert(receivedInputs[i].id == sent.id && receivedInputs[i].thr == sent.thr && receivedInputs[i].steer == sent.steer);
+  }
 
-  printf("Part2: Test passed successfully!\n");
+  printf("Part7: Test passed successfully!\n");
+
+  // a freed slot comes back with a new generation, handles to what lived there before stop resolving
+  EntityRegistry<int> registry(3);
+  const EntityHandle first = registry.create(1);
+  const EntityHandle second = registry.create(2);
+  assert(registry.create(3) != invalid_handle);
+  assert(registry.create(4) == invalid_handle); // out of slots
+  assert(registry.remove(first) && !registry.remove(first));
+  assert(registry.get(first) == nullptr && !registry.contains(handle_index(first)));
+  const EntityHandle reused = registry.create(5);
+  assert(handle_index(reused) == handle_index(first) && handle_generation(reused) == handle_generation(first) + 1);
+  assert(registry.get(first) == nullptr && *registry.get(reused) == 5);
+  assert(registry.handle_of(handle_index(first)) == reused);
+  assert(*registry.get(second) == 2 && registry.size() == 3);
+  assert(registry.get(invalid_handle) == nullptr);
+  EntityRegistry<int> serverRegistry(max_wire_entities);
+  EntityHandle last = invalid_handle;
+  for (EntityHandle handle; (handle = serverRegistry.create(0)) != invalid_handle;)
+    last = handle;
+  assert(serverRegistry.size() == max_wire_entities && handle_index(last) < invalid_entity);
+
+  printf("Part8: Test passed successfully!\n");
 }
 
 int main(int argc, const char **argv)
@@ -114,6 +384,7 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet client\n");
     return 1;
   }
+  apply_host_options(client, argc, argv);
 
   ENetAddress address;
   enet_address_set_host(&address, "localhost");
@@ -146,8 +417,7 @@ int main(int argc, const char **argv)
   camera.rotation = 0.f;
   camera.zoom = 10.f;
 
-  localInputHistory.reference_id = cur_input_id;
-  localInputHistory.inputHistory.push_back({cur_input_id, 0, 0});
+  localInputHistory.reference_id = static_cast<uint16_t>(cur_input_id - 1);
 
   SetTargetFPS(60);               // Set our game to run at 60 frames-per-second
 
@@ -177,11 +447,17 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SNAPSHOT:
           on_snapshot(event.packet);
           break;
+        case E_SERVER_TO_CLIENT_CODED_SNAPSHOT:
+          on_coded_snapshot(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_ENTITY_CELL:
+          on_entity_cell(event.packet);
+          break;
         case E_SERVER_TO_CLIENT_INPUT_ACK:
-          on_input_ack(event.packet, localInputHistory.reference_id);
-          std::erase_if(localInputHistory.inputHistory, [](auto& localInput) {
-            return localInput.id < localInputHistory.reference_id;
-          });
+          on_input_ack(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_REMOVE_ENTITY:
+          on_remove_entity(event.packet);
           break;
         };
         enet_packet_destroy(event.packet);
@@ -196,33 +472,23 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          uint8_t header = 0x0;
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
-
-          Input cur_input = {cur_input_id++, thr, steer};
-          localInputHistory.inputHistory.push_back(cur_input);
-
-          for (Input& input : localInputHistory.inputHistory)
-          {
-            if (input.id == localInputHistory.reference_id)
-            {
-              if (input.steer != cur_input.steer || input.thr != cur_input.thr) {
-                header = 0x80;
-              }
-              break;
-            }
-          }
-
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer, header, cur_input_id, localInputHistory.reference_id);
-        }
+      if (entities.contains(my_entity))
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+
+        Input cur_input = {cur_input_id++, thr, steer};
+        localInputHistory.inputHistory.push_back(cur_input);
+        // nothing older than the window can be resent anyway
+        while (localInputHistory.inputHistory.size() > input_window_size)
+          localInputHistory.inputHistory.pop_front();
+
+        // Send, every packet repeats all inputs the server hasn't acked
+        send_entity_input(upstream, my_entity, localInputHistory.inputHistory);
+      }
     }
+    send_bundle(serverPeer, upstream);
 
     BeginDrawing();
       ClearBackground(GRAY);
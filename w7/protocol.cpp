@@ -1,92 +1,168 @@
 #include "protocol.h"
+#include "net_send.h"
 #include "quantisation.h"
+#include "message_schema.h"
+#include "varint.h"
 #include <cstring> // memcpy
 #include <iostream>
 
+typedef MessageSchema<E_CLIENT_TO_SERVER_JOIN> JoinMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_NEW_ENTITY, RawField<Entity>> NewEntityMsg;
+typedef MessageSchema<E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, Field<uint16_t>> SetControlledEntityMsg;
+// eid, id of the newest input, number of inputs minus 1, then runs of equal inputs from the newest back:
+// 4 bits thr, 4 bits steer, run length minus 1
+typedef MessageSchema<E_CLIENT_TO_SERVER_INPUT, Field<uint16_t>, Field<uint16_t>, Field<uint8_t, input_window_bits>> EntityInputMsg;
+typedef Field<uint8_t, 4> InputValueField;
+typedef Field<uint8_t, input_window_bits> InputRunField;
+constexpr size_t entity_input_max_bytes =
+  bits_to_bytes(EntityInputMsg::num_bits + input_window_size * (2 * InputValueField::num_bits + InputRunField::num_bits));
+// eid, precision level, server tick, cell generation parity, then 11 + 10 bits of cell offset and
+// 8 bits of orientation minus the ones the level drops
+typedef MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint8_t, precision_level_bits>> SnapshotHeaderMsg;
+template <PrecisionLevel level>
+using SnapshotMsg = MessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, Field<uint16_t>, Field<uint8_t, precision_level_bits>,
+                                  Field<uint16_t>, Field<uint8_t, 1>,
+                                  Field<uint32_t, 11 - precision_drop[level].x>,
+                                  Field<uint32_t, 10 - precision_drop[level].y>,
+                                  Field<uint8_t, 8 - precision_drop[level].ori>>;
+constexpr uint32_t position_y_bits = 10;
+constexpr uint32_t position_y_mask = (1u << position_y_bits) - 1;
+typedef MessageSchema<E_SERVER_TO_CLIENT_INPUT_ACK, Field<uint16_t>> InputAckMsg;
+// seq, 1 bit "has baseline", baseline seq, then the range-coded body
+typedef MessageSchema<E_SERVER_TO_CLIENT_CODED_SNAPSHOT, Field<uint16_t>, Field<bool, 1>, Field<uint16_t>> CodedSnapshotHeaderMsg;
+typedef MessageSchema<E_CLIENT_TO_SERVER_SNAPSHOT_ACK, Field<uint16_t>> SnapshotAckMsg;
+// eid, cell generation, then cell x and y as zigzag varints
+typedef MessageSchema<E_SERVER_TO_CLIENT_ENTITY_CELL, Field<uint16_t>, Field<uint8_t>> EntityCellHeaderMsg;
+constexpr size_t entity_cell_max_bytes = EntityCellHeaderMsg::num_bytes + 2 * 5;
+typedef MessageSchema<E_SERVER_TO_CLIENT_REMOVE_ENTITY, Field<uint16_t>> RemoveEntityMsg;
+
+// baseline of the very first snapshots and of the ones whose baseline is gone: default models, no entities
+static const SnapshotCodingState emptyCodingState;
+
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  ENetPacket *packet = enet_packet_create(nullptr, JoinMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  JoinMsg::write(packet->data);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_NEW_ENTITY);
-  bs.write(ent);
+  ENetPacket *packet = enet_packet_create(nullptr, NewEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  NewEntityMsg::write(packet->data, ent);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY);
-  bs.write(eid);
+  ENetPacket *packet = enet_packet_create(nullptr, SetControlledEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  SetControlledEntityMsg::write(packet->data, eid);
 
-  enet_peer_send(peer, 0, packet);
+  net_send(peer, 0, packet);
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori, uint8_t header, uint16_t cur_id, uint16_t ref_id)
+void send_entity_input(UpstreamBundle &bundle, uint16_t eid, const std::deque<Input> &inputs)
 {
-  size_t packet_size = sizeof(uint8_t) + sizeof(uint16_t) * 3 + sizeof(uint8_t);
-  if (header == 0x80) // 0b10000000
-    packet_size += sizeof(uint8_t);
+  if (inputs.empty())
+    return;
+  const size_t count = std::min(inputs.size(), input_window_size);
 
-  ENetPacket *packet = enet_packet_create(nullptr, packet_size,
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_CLIENT_TO_SERVER_INPUT);
-  bs.write(eid);
-  bs.write(cur_id);
-  bs.write(ref_id);
-  bs.write(header);
-
-  if (header == 0x80) { // 0b10000000
-    float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-    float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-    uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-    bs.write(thrSteerPacked);
+  uint8_t buffer[entity_input_max_bytes];
+  Bitstream bs(buffer, sizeof(buffer));
+  EntityInputMsg::write(bs, eid, inputs.back().id, static_cast<uint8_t>(count - 1));
+  // inputs rarely change, a held key is one run
+  auto it = inputs.rbegin();
+  for (size_t left = count; left > 0;)
+  {
+    const uint8_t thr = float4bitsQuantized(it->thr).packedVal;
+    const uint8_t steer = float4bitsQuantized(it->steer).packedVal;
+    uint8_t runLength = 0;
+    do
+    {
+      ++it;
+      ++runLength;
+      --left;
+    } while (left > 0 && float4bitsQuantized(it->thr).packedVal == thr && float4bitsQuantized(it->steer).packedVal == steer);
+    InputValueField::write(bs, thr);
+    InputValueField::write(bs, steer);
+    InputRunField::write(bs, static_cast<uint8_t>(runLength - 1));
   }
+  bs.flush();
 
-  enet_peer_send(peer, 1, packet);
+  memcpy(bundle.append(bs.bytes_processed()), buffer, bs.bytes_processed());
 }
 
-typedef PackedFloat2<uint32_t, 11, 10> PositionQuantized;
+void send_snapshot(ENetPeer *peer, const Entity &ent, uint16_t tick, PrecisionLevel level)
+{
+  PositionQuantized posQuantized({ent.x - cell_origin_x(ent.cell), ent.y - cell_origin_y(ent.cell)});
+  OrientationQuantized oriQuantized(ent.ori);
+  send_snapshot(peer, ent.eid, tick, ent.cellGen, posQuantized.packedVal, oriQuantized.packedVal, level);
+}
+
+template <PrecisionLevel level>
+static ENetPacket *create_snapshot_packet(uint16_t eid, uint16_t tick, uint8_t cell_gen, uint32_t pos_packed,
+                                          uint8_t ori_packed)
+{
+  constexpr PrecisionDrop drop = precision_drop[level];
+  ENetPacket *packet = enet_packet_create(nullptr, SnapshotMsg<level>::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  SnapshotMsg<level>::write(packet->data, eid, level, tick, static_cast<uint8_t>(cell_gen & 1),
+                            reduce_precision(pos_packed >> position_y_bits, drop.x),
+                            reduce_precision(pos_packed & position_y_mask, drop.y),
+                            static_cast<uint8_t>(reduce_precision(ori_packed, drop.ori)));
+  return packet;
+}
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+void send_snapshot(ENetPeer *peer, uint16_t eid, uint16_t tick, uint8_t cell_gen, uint32_t pos_packed, uint8_t ori_packed,
+                   PrecisionLevel level)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_SNAPSHOT);
-  bs.write(eid);
-  PositionQuantized posQuantized{{x, y}, {-16.f, -8.f}, {16.f, 8.f}};
-  auto oriPacked = pack_float<uint8_t>(ori, -pi, pi, 8);
+  ENetPacket *packet = nullptr;
+  switch (level)
+  {
+  case E_PRECISION_FULL:
+    packet = create_snapshot_packet<E_PRECISION_FULL>(eid, tick, cell_gen, pos_packed, ori_packed);
+    break;
+  case E_PRECISION_MEDIUM:
+    packet = create_snapshot_packet<E_PRECISION_MEDIUM>(eid, tick, cell_gen, pos_packed, ori_packed);
+    break;
+  default:
+    packet = create_snapshot_packet<E_PRECISION_LOW>(eid, tick, cell_gen, pos_packed, ori_packed);
+    break;
+  }
+
+  net_send(peer, 1, packet);
+}
 
-  bs.write(posQuantized.packedVal);
-  bs.write(oriPacked);
+// reliable and on the same channel as new entities, so the client never sees a cell for an unknown eid
+void send_entity_cell(ENetPeer *peer, const Entity &ent)
+{
+  uint8_t buffer[entity_cell_max_bytes];
+  Bitstream bs(buffer, sizeof(buffer));
+  EntityCellHeaderMsg::write(bs, ent.eid, ent.cellGen);
+  write_zigzag(bs, ent.cell.x);
+  write_zigzag(bs, ent.cell.y);
+  bs.flush();
 
-  enet_peer_send(peer, 1, packet);
+  ENetPacket *packet = enet_packet_create(buffer, bs.bytes_processed(), ENET_PACKET_FLAG_RELIABLE);
+  net_send(peer, 0, packet);
 }
 
 void send_input_ack(ENetPeer* peer, uint16_t ref_id)
 {
-  ENetPacket* packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                          ENET_PACKET_FLAG_UNSEQUENCED);
-  auto bs = Bitstream(packet->data);
-  bs.write(E_SERVER_TO_CLIENT_INPUT_ACK);
-  bs.write(ref_id);
-  enet_peer_send(peer, 1, packet);
+  ENetPacket* packet = enet_packet_create(nullptr, InputAckMsg::num_bytes, ENET_PACKET_FLAG_UNSEQUENCED);
+  InputAckMsg::write(packet->data, ref_id);
+
+  net_send(peer, 1, packet);
+}
+
+// reliable on the new entity channel too, the removal can't overtake the entity's creation
+void send_remove_entity(ENetPeer *peer, uint16_t eid)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, RemoveEntityMsg::num_bytes, ENET_PACKET_FLAG_RELIABLE);
+  RemoveEntityMsg::write(packet->data, eid);
+
+  net_send(peer, 0, packet);
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -96,84 +172,212 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(ent);
+  MessageView<NewEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  ent = view.get<0>();
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(eid);
+  MessageView<SetControlledEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer, uint16_t& cur_id)
+static float unpack_input_value(uint8_t packed)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  uint16_t ref_id;
-  uint8_t header;
-  bs.read(type);
-  bs.read(eid);
-  bs.read(cur_id);
-  bs.read(ref_id);
-  bs.read(header);
-
-  if (header == 0x80) { // 0b10000000
-    int8_t thrSteerPacked = 0;
-    bs.read(thrSteerPacked);
-
-    static auto neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-    float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-    float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-    thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-    steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-
-  }
-  else {
-    auto cur_input = *serverInputHistory[eid].inputHistory.end();
-    steer = cur_input.steer;
-    thr = cur_input.thr;
-  }
+  static const uint8_t neutralPackedValue = float4bitsQuantized(0.f).packedVal;
+  return packed == neutralPackedValue ? 0.f : float4bitsQuantized(packed).get<0>();
+}
 
-  serverInputHistory[eid].inputHistory.push_back({cur_id, thr, steer});
+bool deserialize_entity_input(ENetPacket *packet, uint16_t &eid, std::vector<Input> &inputs)
+{
+  Bitstream bs(packet->data, packet->dataLength);
+  uint16_t newestId = 0;
+  uint8_t countMinusOne = 0;
+  if (!EntityInputMsg::read(bs, eid, newestId, countMinusOne))
+    return false;
 
-  if (serverInputHistory[eid].reference_id < ref_id)
+  const size_t count = size_t(countMinusOne) + 1;
+  inputs.resize(count);
+  for (size_t filled = 0; filled < count;)
   {
-    std::erase_if(serverInputHistory[eid].inputHistory, [ref_id](auto& localInput) {
-      return localInput.id < ref_id;
-    });
-    serverInputHistory[eid].reference_id = ref_id;
+    uint8_t thr = 0, steer = 0, runMinusOne = 0;
+    InputValueField::read(bs, thr);
+    InputValueField::read(bs, steer);
+    InputRunField::read(bs, runMinusOne);
+    if (bs.overflow() || filled + runMinusOne + 1 > count)
+      return false;
+    const Input input = {0, unpack_input_value(thr), unpack_input_value(steer)};
+    for (size_t i = 0; i <= runMinusOne; ++i, ++filled)
+    {
+      Input &dst = inputs[count - 1 - filled];
+      dst = input;
+      dst.id = static_cast<uint16_t>(newestId - filled);
+    }
   }
+  return true;
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+template <PrecisionLevel level>
+static bool read_snapshot_packet(ENetPacket *packet, uint16_t &eid, uint16_t &tick, uint8_t &cell_gen_parity,
+                                 uint32_t &pos_packed, uint8_t &ori_packed)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(eid);
+  constexpr PrecisionDrop drop = precision_drop[level];
+  MessageView<SnapshotMsg<level>> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return false;
+  eid = view.template get<0>();
+  tick = view.template get<2>();
+  cell_gen_parity = view.template get<3>();
+  pos_packed = restore_precision(view.template get<4>(), drop.x) << position_y_bits | restore_precision(view.template get<5>(), drop.y);
+  ori_packed = static_cast<uint8_t>(restore_precision(view.template get<6>(), drop.ori));
+  return true;
+}
+
+bool deserialize_snapshot(ENetPacket *packet, uint16_t &eid, uint16_t &tick, uint8_t &cell_gen_parity, float &x, float &y,
+                          float &ori)
+{
+  MessageView<SnapshotHeaderMsg> header(packet->data, packet->dataLength);
+  if (!header.valid())
+    return false;
 
   uint32_t posPacked = 0;
-  bs.read(posPacked);
   uint8_t oriPacked = 0;
-  bs.read(oriPacked);
+  bool ok = false;
+  switch (header.get<1>())
+  {
+  case E_PRECISION_FULL:
+    ok = read_snapshot_packet<E_PRECISION_FULL>(packet, eid, tick, cell_gen_parity, posPacked, oriPacked);
+    break;
+  case E_PRECISION_MEDIUM:
+    ok = read_snapshot_packet<E_PRECISION_MEDIUM>(packet, eid, tick, cell_gen_parity, posPacked, oriPacked);
+    break;
+  case E_PRECISION_LOW:
+    ok = read_snapshot_packet<E_PRECISION_LOW>(packet, eid, tick, cell_gen_parity, posPacked, oriPacked);
+    break;
+  default:
+    break;
+  }
+  if (!ok)
+    return false;
 
   PositionQuantized posQuantized{posPacked};
-  PositionQuantized::float2 pos = posQuantized.unpack({-16.f, -8.f}, {16.f, 8.f});
-  x = pos.x;
-  y = pos.y;
+  x = posQuantized.get<0>();
+  y = posQuantized.get<1>();
 
-  ori = unpack_float<uint8_t>(oriPacked, -pi, pi, 8);
+  ori = OrientationQuantized(oriPacked).get<0>();
+  return true;
+}
+
+void deserialize_entity_cell(ENetPacket *packet, uint16_t &eid, WorldCell &cell, uint8_t &cell_gen)
+{
+  Bitstream bs(packet->data, packet->dataLength);
+  uint16_t cellEid = invalid_entity;
+  uint8_t gen = 0;
+  if (!EntityCellHeaderMsg::read(bs, cellEid, gen))
+    return;
+  const int64_t cx = read_zigzag(bs);
+  const int64_t cy = read_zigzag(bs);
+  if (bs.overflow())
+    return;
+  eid = cellEid;
+  cell = {static_cast<int32_t>(cx), static_cast<int32_t>(cy)};
+  cell_gen = gen;
+}
+
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid)
+{
+  MessageView<RemoveEntityMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  eid = view.get<0>();
 }
 
 void deserialize_input_ack(ENetPacket* packet, uint16_t& ref_id)
 {
-  auto bs = Bitstream(packet->data);
-  MessageType type{};
-  bs.read(type);
-  bs.read(ref_id);
+  MessageView<InputAckMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  ref_id = view.get<0>();
+}
+
+bool send_coded_snapshot(ENetPeer *peer, uint16_t seq, const SnapshotCodingState *base, uint16_t base_seq,
+                         const QuantizedEntity *entities, size_t count, SnapshotCodingState &result)
+{
+  static thread_local std::vector<uint8_t> buffer; // snapshots are encoded on job threads
+  buffer.resize(CodedSnapshotHeaderMsg::num_bytes + (count + 1) * snapshot_max_entity_bytes);
+
+  Bitstream bs(buffer.data(), buffer.size());
+  CodedSnapshotHeaderMsg::write(bs, seq, base != nullptr, base ? base_seq : 0);
+  encode_snapshot_body(base ? *base : emptyCodingState, entities, count, bs, result);
+  bs.flush();
+  if (bs.overflow())
+    return false;
+
+  ENetPacket *packet = enet_packet_create(buffer.data(), bs.bytes_processed(), ENET_PACKET_FLAG_UNSEQUENCED);
+  net_send(peer, 1, packet);
+  return true;
+}
+
+const SnapshotCodingState *deserialize_coded_snapshot(ENetPacket *packet, SnapshotHistory &history, uint16_t &seq)
+{
+  Bitstream bs(packet->data, packet->dataLength);
+  bool hasBase = false;
+  uint16_t baseSeq = 0;
+  if (!CodedSnapshotHeaderMsg::read(bs, seq, hasBase, baseSeq))
+    return nullptr;
+
+  const SnapshotCodingState *base = hasBase ? history.find(baseSeq) : &emptyCodingState;
+  if (!base)
+    return nullptr;
+
+  SnapshotCodingState state;
+  if (!decode_snapshot_body(*base, bs, state))
+    return nullptr;
+  history.store(seq, std::move(state));
+  return history.find(seq);
+}
+
+void send_snapshot_ack(UpstreamBundle &bundle, uint16_t seq)
+{
+  SnapshotAckMsg::write(bundle.append(SnapshotAckMsg::num_bytes), seq);
+}
+
+void send_bundle(ENetPeer *peer, UpstreamBundle &bundle)
+{
+  if (bundle.empty())
+    return;
+  ENetPacket *packet = enet_packet_create(bundle.data(), bundle.size(), ENET_PACKET_FLAG_UNSEQUENCED);
+  bundle.clear();
+
+  net_send(peer, 1, packet);
+}
+
+void deserialize_snapshot_ack(ENetPacket *packet, uint16_t &seq)
+{
+  MessageView<SnapshotAckMsg> view(packet->data, packet->dataLength);
+  if (!view.valid())
+    return;
+  seq = view.get<0>();
+}
+
+bool unpack_bundle(ENetPacket *packet, const std::function<void(ENetPacket *)> &on_message)
+{
+  const uint8_t *ptr = packet->data + 1;
+  const uint8_t *end = packet->data + packet->dataLength;
+  while (ptr < end)
+  {
+    const size_t size = *ptr++;
+    if (size == 0 || size > size_t(end - ptr) || *ptr == E_CLIENT_TO_SERVER_BUNDLE)
+      return false;
+    ENetPacket message = *packet;
+    message.data = const_cast<uint8_t *>(ptr);
+    message.dataLength = size;
+    on_message(&message);
+    ptr += size;
+  }
+  return true;
 }
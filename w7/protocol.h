@@ -3,9 +3,12 @@
 #include <cstdint>
 #include "entity.h"
 #include "bitstream.h"
+#include "precision.h"
+#include "snapshot_coder.h"
 
 #include <vector>
 #include <deque>
+#include <functional>
 #include <map>
 
 struct Input
@@ -15,13 +18,16 @@ struct Input
   float steer;
 };
 
+// inputs the server hasn't acked yet, reference_id is the last acked one
 struct InputHistory
 {
   uint16_t reference_id = 0;
   std::deque<Input> inputHistory;
 };
 
-static std::map<uint16_t, InputHistory> serverInputHistory;
+// every input packet repeats up to this many of the newest unacked inputs
+constexpr uint32_t input_window_bits = 5;
+constexpr size_t input_window_size = 1 << input_window_bits;
 
 enum MessageType : uint8_t
 {
@@ -31,21 +37,74 @@ enum MessageType : uint8_t
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_INPUT_ACK,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_CLIENT_TO_SERVER_SNAPSHOT_ACK
+  E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  E_SERVER_TO_CLIENT_CODED_SNAPSHOT,
+  E_SERVER_TO_CLIENT_ENTITY_CELL,
+  E_CLIENT_TO_SERVER_BUNDLE,
+  E_SERVER_TO_CLIENT_REMOVE_ENTITY
+};
+
+// Everything the client sends unreliably during a frame (inputs, snapshot acks) goes to the server as
+// one datagram: the bundle type byte, then every message as it would be sent alone behind a 1-byte length.
+class UpstreamBundle {
+public:
+  // room for one message of size bytes, nullptr if it can't be bundled
+  uint8_t *append(size_t size) {
+    if (size == 0 || size > 0xff)
+      return nullptr;
+    if (data_.empty())
+      data_.push_back(E_CLIENT_TO_SERVER_BUNDLE);
+    data_.push_back(static_cast<uint8_t>(size));
+    data_.resize(data_.size() + size);
+    return data_.data() + data_.size() - size;
+  }
+
+  bool empty() const { return data_.empty(); }
+  const uint8_t *data() const { return data_.data(); }
+  size_t size() const { return data_.size(); }
+  void clear() { data_.clear(); }
+
+private:
+  std::vector<uint8_t> data_;
 };
 
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer, uint8_t header, uint16_t cur_id, uint16_t ref_id);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// the newest input_window_size of inputs, ids must be consecutive
+void send_entity_input(UpstreamBundle &bundle, uint16_t eid, const std::deque<Input> &inputs);
+// x and y are world coordinates, sent as an offset from the entity's cell
+void send_snapshot(ENetPeer *peer, const Entity &ent, uint16_t tick, PrecisionLevel level);
+// already quantised with PositionQuantized (cell offset) / OrientationQuantized
+void send_snapshot(ENetPeer *peer, uint16_t eid, uint16_t tick, uint8_t cell_gen, uint32_t pos_packed, uint8_t ori_packed,
+                   PrecisionLevel level);
+void send_entity_cell(ENetPeer *peer, const Entity &ent);
+// the entity is gone for good, its eid may come back as a new one
+void send_remove_entity(ENetPeer *peer, uint16_t eid);
 void send_input_ack(ENetPeer* peer, uint16_t ref_id);
+// base is the state after the last snapshot the peer acked (base_seq), nullptr if there is none;
+// false and nothing sent when the snapshot doesn't fit into a packet
+bool send_coded_snapshot(ENetPeer *peer, uint16_t seq, const SnapshotCodingState *base, uint16_t base_seq,
+                         const QuantizedEntity *entities, size_t count, SnapshotCodingState &result);
+void send_snapshot_ack(UpstreamBundle &bundle, uint16_t seq);
+// one packet with everything bundled since the last call, nothing if it's empty
+void send_bundle(ENetPeer *peer, UpstreamBundle &bundle);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer, uint16_t& cur_id);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+// inputs come out oldest first
+bool deserialize_entity_input(ENetPacket *packet, uint16_t &eid, std::vector<Input> &inputs);
+// x and y are the offset from the cell, cell_gen_parity is the low bit of the cell generation it belongs to
+bool deserialize_snapshot(ENetPacket *packet, uint16_t &eid, uint16_t &tick, uint8_t &cell_gen_parity, float &x, float &y,
+                          float &ori);
+void deserialize_entity_cell(ENetPacket *packet, uint16_t &eid, WorldCell &cell, uint8_t &cell_gen);
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_input_ack(ENetPacket* packet, uint16_t& ref_id);
+// decoded state is stored in history, nullptr if the packet is malformed or its baseline is already gone
+const SnapshotCodingState *deserialize_coded_snapshot(ENetPacket *packet, SnapshotHistory &history, uint16_t &seq);
+void deserialize_snapshot_ack(ENetPacket *packet, uint16_t &seq);
+// calls on_message for every bundled message with a packet that points into the bundle, false if it's malformed
+bool unpack_bundle(ENetPacket *packet, const std::function<void(ENetPacket *)> &on_message);
 
@@ -1,6 +1,15 @@
 #pragma once
 #include "mathUtils.h"
+#include "world_cell.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
+#include <utility>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define QUANTISATION_SSE2 1
+#endif
 
 template<typename T>
 T pack_float(float v, float lo, float hi, int num_bits)
@@ -18,110 +27,201 @@ float unpack_float(T c, float lo, float hi, int num_bits)
 
 ///--------------------------------------------------
 
-template<typename T, int num_bits>
-struct PackedFloat
+// Compile-time quantisation range of one float, usable as a template argument
+struct QuantRange
 {
-  static_assert(num_bits <= sizeof(T) * 8, "ASSERT: type is too small");
+  int num_bits;
+  float lo;
+  float hi;
+};
 
-  T packedVal;
+template <QuantRange range>
+struct Quantizer
+{
+  static_assert(range.num_bits > 0 && range.num_bits < 32, "ASSERT: wrong number of bits");
+  static_assert(range.lo < range.hi, "ASSERT: empty range");
 
-  PackedFloat(float v, float lo, float hi)
+  static constexpr uint32_t max_value = (1u << range.num_bits) - 1;
+  // reciprocals are folded at compile time, packing is a multiply instead of a divide
+  static constexpr float scale = static_cast<float>(max_value) / (range.hi - range.lo);
+  static constexpr float inv_scale = (range.hi - range.lo) / static_cast<float>(max_value);
+
+  static uint32_t pack(float v)
   {
-    pack(v, lo, hi);
+    return static_cast<uint32_t>((clamp(v, range.lo, range.hi) - range.lo) * scale);
   }
 
-  PackedFloat(T compressed_val) : packedVal(compressed_val) {}
+  static float unpack(uint32_t c)
+  {
+    return static_cast<float>(c) * inv_scale + range.lo;
+  }
 
-  void pack(float v, float lo, float hi)
+#if defined(QUANTISATION_SSE2)
+  static __m128i pack4(__m128 v)
   {
-    packedVal = pack_float<T>(v, lo, hi, num_bits);
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(range.lo)), _mm_set1_ps(range.hi));
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(v, _mm_set1_ps(range.lo)), _mm_set1_ps(scale)));
   }
 
-  float unpack(float lo, float hi)
+  static __m128 unpack4(__m128i c)
   {
-    return unpack_float<T>(packedVal, lo, hi, num_bits);
+    return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), _mm_set1_ps(inv_scale)), _mm_set1_ps(range.lo));
   }
+#endif
 };
 
-typedef PackedFloat<uint8_t, 4> float4bitsQuantized;
+// in[i] -> out[i] for a whole array of one field
+template <QuantRange range>
+void quantize_batch(const float* in, uint32_t* out, size_t count)
+{
+  size_t i = 0;
+#if defined(QUANTISATION_SSE2)
+  for (const size_t simd_count = count & ~size_t(3); i < simd_count; i += 4)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), Quantizer<range>::pack4(_mm_loadu_ps(in + i)));
+#endif
+  for (; i < count; ++i)
+    out[i] = Quantizer<range>::pack(in[i]);
+}
+
+template <QuantRange range>
+void dequantize_batch(const uint32_t* in, float* out, size_t count)
+{
+  size_t i = 0;
+#if defined(QUANTISATION_SSE2)
+  for (const size_t simd_count = count & ~size_t(3); i < simd_count; i += 4)
+    _mm_storeu_ps(out + i, Quantizer<range>::unpack4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+#endif
+  for (; i < count; ++i)
+    out[i] = Quantizer<range>::unpack(in[i]);
+}
 
 ///--------------------------------------------------
 
-template <typename T, int num_bits_x, int num_bits_y>
-struct PackedFloat2
+// Several floats packed into one integer, the first range takes the highest bits:
+//   PackedFloatN<uint32_t, QuantRange{11, -16.f, 16.f}, QuantRange{10, -8.f, 8.f}> = x:11 | y:10
+template <typename T, QuantRange... ranges>
+struct PackedFloatN
 {
-  static_assert(num_bits_x + num_bits_y <= sizeof(T) * 8, "ASSERT: type is too small");
+  static constexpr size_t num_values = sizeof...(ranges);
+  static constexpr int num_bits = (ranges.num_bits + ...);
+  static_assert(num_bits <= sizeof(T) * 8, "ASSERT: type is too small");
+
+  typedef std::array<float, num_values> floatN;
 
   T packedVal;
 
-  struct float2
-  {
-    float x;
-    float y;
-  };
+  PackedFloatN(const floatN& v) { pack(v); }
+  PackedFloatN(float v) requires (num_values == 1) { pack({v}); }
+  PackedFloatN(T compressed_val) : packedVal(compressed_val) {}
 
-  PackedFloat2(float2 v, float2 lo, float2 hi)
+  void pack(const floatN& v)
   {
-    pack(v, lo, hi);
+    pack_impl(v, std::make_index_sequence<num_values>{});
   }
 
-  PackedFloat2(T compressed_val) : packedVal(compressed_val) {}
-
-  void pack(float2 v, float2 lo, float2 hi)
+  floatN unpack() const
   {
-    const auto packed_x = pack_float<T>(v.x, lo.x, hi.x, num_bits_x);
-    const auto packed_y = pack_float<T>(v.y, lo.y, hi.y, num_bits_y);
-
-    packedVal = packed_x << num_bits_y | packed_y;
+    return unpack_impl(std::make_index_sequence<num_values>{});
   }
 
-  float2 unpack(float2 lo, float2 hi)
+  template <size_t I>
+  float get() const
   {
-    float2 ret;
-    ret.x = unpack_float<T>(packedVal >> num_bits_y, lo.x, hi.x, num_bits_x);
-    ret.y = unpack_float<T>(packedVal & ((1 << num_bits_y) - 1), lo.y, hi.y, num_bits_y);
-    return ret;
+    constexpr QuantRange range = range_at(I);
+    return Quantizer<range>::unpack((packedVal >> shift_at(I)) & Quantizer<range>::max_value);
   }
-};
-
-///--------------------------------------------------
 
-template <typename T, int num_bits_x, int num_bits_y, int num_bits_z>
-struct PackedFloat3
-{
-  static_assert(num_bits_x + num_bits_y + num_bits_z <= sizeof(T) * 8, "ASSERT: type is too small");
+  // SoA arrays in, one packed value per entity out: pack_batch(out, count, xs, ys)
+  template <typename... Arrays>
+  static void pack_batch(T* out, size_t count, const Arrays*... soa)
+  {
+    static_assert(sizeof...(Arrays) == num_values, "ASSERT: one array per packed value");
+    pack_batch_impl(out, count, std::make_index_sequence<num_values>{}, soa...);
+  }
 
-  T packedVal;
+  template <typename... Arrays>
+  static void unpack_batch(const T* in, size_t count, Arrays*... soa)
+  {
+    static_assert(sizeof...(Arrays) == num_values, "ASSERT: one array per packed value");
+    unpack_batch_impl(in, count, std::make_index_sequence<num_values>{}, soa...);
+  }
 
-  struct float3
+private:
+  static constexpr QuantRange range_at(size_t index)
   {
-    float x;
-    float y;
-    float z;
-  };
+    constexpr QuantRange all[] = {ranges...};
+    return all[index];
+  }
 
-  PackedFloat3(float3 v, float3 lo, float3 hi)
+  // bit offset of value index, counted from the lowest bit
+  static constexpr int shift_at(size_t index)
   {
-    pack(v, lo, hi);
+    int shift = 0;
+    for (size_t i = index + 1; i < num_values; ++i)
+      shift += range_at(i).num_bits;
+    return shift;
   }
 
-  PackedFloat3(T compressed_val) : packedVal(compressed_val) {}
+  template <size_t... I>
+  void pack_impl(const floatN& v, std::index_sequence<I...>)
+  {
+    packedVal = static_cast<T>(((static_cast<T>(Quantizer<range_at(I)>::pack(v[I])) << shift_at(I)) | ...));
+  }
 
-  void pack(float3 v, float3 lo, float3 hi)
+  template <size_t... I>
+  floatN unpack_impl(std::index_sequence<I...>) const
   {
-    const auto packedX = pack_float<T>(v.x, lo.x, hi.x, num_bits_x);
-    const auto packedY = pack_float<T>(v.y, lo.y, hi.y, num_bits_y);
-    const auto packedZ = pack_float<T>(v.z, lo.z, hi.z, num_bits_z);
+    return {get<I>()...};
+  }
 
-    packedVal = (packedX << (num_bits_y + num_bits_z)) | (packedY << num_bits_z) | packedZ;
+  template <size_t... I, typename... Arrays>
+  static void pack_batch_impl(T* out, size_t count, std::index_sequence<I...>, const Arrays*... soa)
+  {
+    size_t i = 0;
+#if defined(QUANTISATION_SSE2)
+    for (const size_t simd_count = count & ~size_t(3); i < simd_count; i += 4)
+    {
+      // _mm_or_si128, operator| on __m128i is a GCC/Clang vector extension
+      __m128i packed = _mm_setzero_si128();
+      ((packed = _mm_or_si128(packed, _mm_slli_epi32(Quantizer<range_at(I)>::pack4(_mm_loadu_ps(soa + i)), shift_at(I)))), ...);
+      if constexpr (sizeof(T) == sizeof(uint32_t))
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+      else
+      {
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), packed);
+        for (size_t k = 0; k < 4; ++k)
+          out[i + k] = static_cast<T>(lanes[k]);
+      }
+    }
+#endif
+    for (; i < count; ++i)
+      out[i] = static_cast<T>(((static_cast<T>(Quantizer<range_at(I)>::pack(soa[i])) << shift_at(I)) | ...));
   }
 
-  float3 unpack(float3 lo, float3 hi)
+  template <size_t... I, typename... Arrays>
+  static void unpack_batch_impl(const T* in, size_t count, std::index_sequence<I...>, Arrays*... soa)
   {
-    float3 ret;
-    ret.x = unpack_float<T>(packedVal >> (num_bits_y + num_bits_z), lo.x, hi.x, num_bits_x);
-    ret.y = unpack_float<T>((packedVal >> num_bits_z) & ((1 << num_bits_y) - 1), lo.y, hi.y, num_bits_y);
-    ret.z = unpack_float<T>(packedVal & ((1 << num_bits_z) - 1), lo.z, hi.z, num_bits_z);
-    return ret;
+    size_t i = 0;
+#if defined(QUANTISATION_SSE2)
+    for (const size_t simd_count = count & ~size_t(3); i < simd_count; i += 4)
+    {
+      __m128i packed;
+      if constexpr (sizeof(T) == sizeof(uint32_t))
+        packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+      else
+        packed = _mm_setr_epi32(in[i], in[i + 1], in[i + 2], in[i + 3]);
+      ((_mm_storeu_ps(soa + i, Quantizer<range_at(I)>::unpack4(
+        _mm_and_si128(_mm_srli_epi32(packed, shift_at(I)), _mm_set1_epi32(Quantizer<range_at(I)>::max_value))))), ...);
+    }
+#endif
+    for (; i < count; ++i)
+      ((soa[i] = Quantizer<range_at(I)>::unpack((in[i] >> shift_at(I)) & Quantizer<range_at(I)>::max_value)), ...);
   }
 };
+
+typedef PackedFloatN<uint8_t, QuantRange{4, -1.f, 1.f}> float4bitsQuantized;
+// offset from the entity's cell centre
+typedef PackedFloatN<uint32_t, QuantRange{11, -cell_offset_range_x, cell_offset_range_x},
+                     QuantRange{10, -cell_offset_range_y, cell_offset_range_y}> PositionQuantized;
+typedef PackedFloatN<uint8_t, QuantRange{8, -pi, pi}> OrientationQuantized;
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+#include "entity.h"
+#include "entity_registry.h"
+#include "packet_batch.h"
+#include "protocol.h"
+#include "room_scheduler.h"
+#include "snapshot_coder.h"
+
+// inputs received but not simulated yet, one is applied per tick in the order the client made them,
+// so the ones recovered from a later packet's window still get their tick
+struct PendingInputs
+{
+  std::deque<Input> inputs;
+  uint16_t newestId = 0; // acked back to the client
+  bool hasInput = false;
+};
+
+struct PeerSnapshotState
+{
+  SnapshotHistory history;
+  uint16_t nextSeq = 0;
+  uint16_t ackedSeq = 0;
+  bool hasAck = false;
+};
+
+// One match (room_scheduler.h): the cars of its players, what its peers were sent and the peers playing it
+struct Room
+{
+  uint32_t id = 0;
+  EntityRegistry<Entity> entities{max_wire_entities};
+  std::map<uint16_t, ENetPeer*> controlledMap;
+  std::map<ENetPeer*, uint16_t> viewerMap;
+  std::vector<ENetPeer*> peers; // playing in it, in join order
+  uint16_t serverTick = 0;      // stamped on snapshots, wraps around
+  std::map<uint16_t, PendingInputs> pendingInputs;
+  std::map<ENetPeer*, PeerSnapshotState> peerSnapshots; // --range-coder only
+
+  // per-tick SoA copies of entity state (positions relative to the entity's cell), quantised in one batch before sending
+  std::vector<float> xs, ys, oris;
+  std::vector<uint32_t> posPacked;
+  std::vector<uint8_t> oriPacked;
+  std::vector<QuantizedEntity> codedEntities;
+  std::vector<PeerSnapshotState*> codedStates; // by peer index, looked up before the jobs start
+  uint32_t oversizedSnapshots = 0;             // coded ones that didn't fit into a packet, since the last report
+
+  RoomClock clock;
+  PacketBatch outbox; // slot 0 for the room's own messages, then one per peer
+
+  bool awake() const { return !peers.empty(); }
+};
+
+// the world of a room nobody plays in anymore, the next match starts from scratch
+inline void reset_room(Room &room)
+{
+  room.entities = EntityRegistry<Entity>(max_wire_entities);
+  room.controlledMap.clear();
+  room.viewerMap.clear();
+  room.serverTick = 0;
+  room.pendingInputs.clear();
+  room.peerSnapshots.clear();
+}
@@ -2,61 +2,363 @@
 #include <iostream>
 #include "entity.h"
 #include "protocol.h"
+#include "entity_registry.h"
+#include "host_options.h"
 #include "mathUtils.h"
+#include "quantisation.h"
+#include "sequence.h"
+#include "tick_scheduler.h"
+#include "net_thread.h"
+#include "job_system.h"
+#include "packet_batch.h"
+#include "room.h"
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <map>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static std::vector<std::unique_ptr<Room>> rooms; // never shrinks, a room stays where it is
+static std::map<ENetPeer*, Room*> peerRooms;
+static uint32_t roomSize = 16; // players per room, --room-size
+static PrecisionPolicy precisionPolicy;
+constexpr uint32_t server_tick_rate = 100;
+static RoomScheduler<Room> scheduler(server_tick_rate);
+constexpr uint32_t metrics_report_interval = 10; // seconds
+static InputLatency inputLatency; // receive to the next room batch, for both threading models
+constexpr uint32_t simulation_grain = 1024; // entities per job
+constexpr uint32_t snapshot_peer_grain = 16; // peers per job
+constexpr uint32_t default_max_peers = 1024; // ENet allows up to 4095 per host
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+// --range-coder: one range-coded snapshot of all entities per peer and tick instead of a packet per entity
+static bool useRangeCoder = false;
+
+void quantize_entities(Room &room)
 {
+  const size_t count = room.entities.size();
+  room.xs.resize(count);
+  room.ys.resize(count);
+  room.oris.resize(count);
+  room.posPacked.resize(count);
+  room.oriPacked.resize(count);
+
+  size_t idx = 0;
+  for (const Entity &e : room.entities)
+  {
+    room.xs[idx] = e.x - cell_origin_x(e.cell);
+    room.ys[idx] = e.y - cell_origin_y(e.cell);
+    room.oris[idx] = e.ori;
+    ++idx;
+  }
+  PositionQuantized::pack_batch(room.posPacked.data(), count, room.xs.data(), room.ys.data());
+  OrientationQuantized::pack_batch(room.oriPacked.data(), count, room.oris.data());
+}
+
+void on_join(ENetPacket *packet, ENetPeer *peer)
+{
+  if (peerRooms.contains(peer))
+    return;
+  Room &room = room_for_new_player(rooms, roomSize);
+
   // send all entities
-  for (const Entity &ent : entities)
+  for (const Entity &ent : room.entities)
     send_new_entity(peer, ent);
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
                    0x00000044 * (rand() % 5);
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
-  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
+  EntityHandle handle = room.entities.create({color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f,
+                                             invalid_entity, cell_of(x, y)});
+  if (handle == invalid_handle)
+  {
+    printf("No free entity slot in room %u, join refused\n", room.id);
+    return;
+  }
+  if (!room.awake())
+    scheduler.wake(room);
+  room.peers.push_back(peer);
+  peerRooms[peer] = &room;
+  uint16_t newEid = handle_index(handle);
+  Entity &ent = *room.entities.get(handle);
+  ent.eid = newEid;
 
-  controlledMap[newEid] = peer;
+  room.controlledMap[newEid] = peer;
+  room.viewerMap[peer] = newEid;
+  room.peerSnapshots.erase(peer);
 
 
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  // send info about new entity to everyone in the room
+  for (ENetPeer *roomPeer : room.peers)
+    send_new_entity(roomPeer, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
 }
 
-void on_input(ENetPacket *packet, ENetPeer* peer)
+void on_leave(ENetPeer *peer)
 {
+  auto it = peerRooms.find(peer);
+  if (it == peerRooms.end())
+    return;
+  Room &room = *it->second;
+  peerRooms.erase(it);
+  room.peers.erase(std::find(room.peers.begin(), room.peers.end(), peer));
+  room.peerSnapshots.erase(peer);
+  if (!room.awake())
+  {
+    reset_room(room);
+    return;
+  }
+
+  // the player's car leaves with it, everyone still in the room is told so
+  auto viewerIt = room.viewerMap.find(peer);
+  if (viewerIt == room.viewerMap.end())
+    return;
+  const uint16_t eid = viewerIt->second;
+  room.viewerMap.erase(viewerIt);
+  room.controlledMap.erase(eid);
+  room.pendingInputs.erase(eid);
+  room.entities.remove_at(eid);
+  for (ENetPeer *roomPeer : room.peers)
+    send_remove_entity(roomPeer, eid);
+}
+
+void on_input(Room &room, ENetPacket *packet, ENetPeer* peer)
+{
+  static std::vector<Input> window;
   uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  uint16_t new_ref_id = 0;
-  deserialize_entity_input(packet, eid, thr, steer, new_ref_id);
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  if (!deserialize_entity_input(packet, eid, window))
+    return;
+
+  if (!room.entities.contains(eid))
+    return;
+
+  // inputs we already have are skipped, the rest fills in whatever earlier packets lost
+  PendingInputs &pending = room.pendingInputs[eid];
+  for (const Input &input : window)
+  {
+    if (pending.hasInput && !sequence_greater(input.id, pending.newestId))
+      continue;
+    pending.inputs.push_back(input);
+    pending.newestId = input.id;
+    pending.hasInput = true;
+  }
+  // a client running ahead of the tick rate would queue up latency, the oldest go first
+  while (pending.inputs.size() > input_window_size)
+    pending.inputs.pop_front();
+
+  send_input_ack(peer, pending.newestId);
+}
+
+// the next input of every entity for the coming tick; with none left it keeps the last one
+void apply_pending_inputs(Room &room)
+{
+  for (auto &[eid, pending] : room.pendingInputs)
+  {
+    if (pending.inputs.empty())
+      continue;
+    if (Entity *e = room.entities.find(eid))
+    {
+      e->thr = pending.inputs.front().thr;
+      e->steer = pending.inputs.front().steer;
+    }
+    pending.inputs.pop_front();
+  }
+}
+
+void on_snapshot_ack(Room &room, ENetPacket *packet, ENetPeer *peer)
+{
+  uint16_t seq = 0;
+  deserialize_snapshot_ack(packet, seq);
+  auto it = room.peerSnapshots.find(peer);
+  if (it == room.peerSnapshots.end())
+    return;
+  PeerSnapshotState &state = it->second;
+  if (!state.hasAck || sequence_greater(seq, state.ackedSeq))
+  {
+    state.ackedSeq = seq;
+    state.hasAck = true;
+  }
+}
+
+// Peers are encoded on the job threads (one by default, the serial loop) and only read the world and
+// their own state. The packets wait in the room's outbox, in peer order.
+void send_snapshots(Room &room, JobSystem &jobs)
+{
+  jobs.parallel_for(static_cast<uint32_t>(room.peers.size()), snapshot_peer_grain, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      ENetPeer *peer = room.peers[i];
+      PacketCapture capture(room.outbox, i + 1);
+      auto viewerIt = room.viewerMap.find(peer);
+      const Entity *viewer = viewerIt != room.viewerMap.end() ? room.entities.find(viewerIt->second) : nullptr;
+      size_t idx = 0;
+      for (const Entity &e : room.entities)
+      {
+        // skip this here in this implementation
+        //if (controlledMap[e.eid] != peer)
+        PrecisionLevel level = viewer ? select_precision(precisionPolicy, viewer->x, viewer->y, e.x, e.y)
+                                      : E_PRECISION_FULL;
+        send_snapshot(peer, e.eid, room.serverTick, e.cellGen, room.posPacked[idx], room.oriPacked[idx], level);
+        ++idx;
+      }
+    }
+  });
+}
+
+void send_coded_snapshots(Room &room, JobSystem &jobs)
+{
+  room.codedEntities.clear();
+  size_t idx = 0;
+  for (const Entity &e : room.entities)
+  {
+    room.codedEntities.push_back({e.eid, static_cast<uint16_t>(room.posPacked[idx] >> 10),
+                                  static_cast<uint16_t>(room.posPacked[idx] & 0x3ff), room.oriPacked[idx], e.cell.x, e.cell.y});
+    ++idx;
+  }
+  std::sort(room.codedEntities.begin(), room.codedEntities.end(),
+            [](const QuantizedEntity &a, const QuantizedEntity &b) { return a.eid < b.eid; });
+
+  // the map may grow, so the peer states are looked up before the jobs start
+  room.codedStates.assign(room.peers.size(), nullptr);
+  for (size_t i = 0; i < room.peers.size(); ++i)
+    if (room.viewerMap.find(room.peers[i]) != room.viewerMap.end())
+      room.codedStates[i] = &room.peerSnapshots[room.peers[i]];
+
+  std::atomic<uint32_t> oversized{0};
+  jobs.parallel_for(static_cast<uint32_t>(room.peers.size()), snapshot_peer_grain, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i)
     {
-      e.thr = thr;
-      e.steer = steer;
+      if (!room.codedStates[i])
+        continue;
+      PeerSnapshotState &state = *room.codedStates[i];
+      PacketCapture capture(room.outbox, i + 1);
+      const uint16_t seq = state.nextSeq++;
+      // the client keeps as many states as we do, an older baseline may be overwritten there already
+      const bool baseAlive = state.hasAck && static_cast<uint16_t>(seq - state.ackedSeq) < snapshot_history_size;
+      const SnapshotCodingState *base = baseAlive ? state.history.find(state.ackedSeq) : nullptr;
+
+      SnapshotCodingState result;
+      if (send_coded_snapshot(room.peers[i], seq, base, state.ackedSeq, room.codedEntities.data(), room.codedEntities.size(), result))
+        state.history.store(seq, std::move(result));
+      else
+        oversized.fetch_add(1, std::memory_order_relaxed);
     }
-  send_input_ack(peer, new_ref_id);
+  });
+  room.oversizedSnapshots += oversized.load(std::memory_order_relaxed);
+}
+
+// the coded snapshot carries cells itself, the packet-per-entity one needs them sent when they change
+void update_cells(Room &room)
+{
+  PacketCapture capture(room.outbox, 0);
+  for (Entity &e : room.entities)
+  {
+    if (!update_cell(e.cell, e.x, e.y))
+      continue;
+    ++e.cellGen;
+    if (useRangeCoder)
+      continue;
+    for (ENetPeer *peer : room.peers)
+      send_entity_cell(peer, e);
+  }
+}
+
+// A room's due ticks and snapshots, on a job thread. Nothing in here touches another room, whatever it
+// sends waits in room.outbox until the batch is over.
+void tick_room(Room &room, JobSystem &jobs, float dt)
+{
+  for (uint32_t t = 0; t < room.clock.dueTicks; ++t)
+  {
+    apply_pending_inputs(room);
+    // every entity only moves itself, any split over threads gives the same floats
+    jobs.parallel_for(static_cast<uint32_t>(room.entities.size()), simulation_grain, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i)
+        simulate_entity(room.entities.data()[i], dt);
+    });
+    ++room.serverTick;
+  }
+
+  room.outbox.resize(room.peers.size() + 1);
+  update_cells(room);
+
+  quantize_entities(room);
+  if (useRangeCoder)
+    send_coded_snapshots(room, jobs);
+  else
+    send_snapshots(room, jobs);
+}
+
+void on_client_message(ENetPacket *packet, ENetPeer *peer, const ENetAddress &from)
+{
+  MessageType type = get_packet_type(packet);
+  if (type == E_CLIENT_TO_SERVER_JOIN)
+  {
+    on_join(packet, peer);
+    return;
+  }
+  auto it = peerRooms.find(peer);
+  if (it == peerRooms.end())
+    return;
+  Room &room = *it->second;
+  switch (type)
+  {
+    case E_CLIENT_TO_SERVER_INPUT:
+      on_input(room, packet, peer);
+      break;
+    case E_CLIENT_TO_SERVER_SNAPSHOT_ACK:
+      on_snapshot_ack(room, packet, peer);
+      break;
+    case E_CLIENT_TO_SERVER_BUNDLE:
+      if (!unpack_bundle(packet, [&](ENetPacket *message) { on_client_message(message, peer, from); }))
+        printf("Malformed bundle from %x:%u\n", from.host, from.port);
+      break;
+    default:
+      break;
+  };
+}
+
+void handle_event(ENetHost *server, NetEvent &netEvent)
+{
+  ENetEvent &event = netEvent.event;
+  switch (event.type)
+  {
+  case ENET_EVENT_TYPE_CONNECT:
+    printf("Connection with %x:%u established\n", netEvent.address.host, netEvent.address.port);
+    break;
+  case ENET_EVENT_TYPE_DISCONNECT:
+    printf("Disconnected %x:%u \n", netEvent.address.host, netEvent.address.port);
+    on_leave(event.peer);
+    break;
+  case ENET_EVENT_TYPE_RECEIVE:
+    on_client_message(event.packet, event.peer, netEvent.address);
+    enet_packet_destroy(event.packet);
+    break;
+  default:
+    break;
+  };
+}
+
+// single-threaded: blocks for up to timeout_ms until something arrives, then handles everything queued
+void service_network(ENetHost *server, uint32_t timeout_ms)
+{
+  ENetEvent event;
+  while (enet_host_service(server, &event, timeout_ms) > 0)
+  {
+    timeout_ms = 0;
+    NetEvent netEvent = make_net_event(event, tick_clock::now_ns());
+    inputLatency.received(netEvent.recvNs);
+    handle_event(server, netEvent);
+  }
 }
 
 int main(int argc, const char **argv)
 {
+  useRangeCoder = has_option(argc, argv, "--range-coder");
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
@@ -67,59 +369,72 @@ int main(int argc, const char **argv)
   address.host = ENET_HOST_ANY;
   address.port = 10131;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  // --max-peers N: every player of every room is a peer of this one host
+  const uint32_t maxPeers = std::clamp(option_value(argc, argv, "--max-peers", default_max_peers), 1u, uint32_t(ENET_PROTOCOL_MAXIMUM_PEER_ID));
+  ENetHost *server = enet_host_create(&address, maxPeers, 2, 0, 0);
 
   if (!server)
   {
     printf("Cannot create ENet server\n");
     return 1;
   }
+  apply_host_options(server, argc, argv);
+  roomSize = std::max(option_value(argc, argv, "--room-size", roomSize), 1u);
+  printf("Up to %u peers in rooms of %u players\n", maxPeers, roomSize);
+
+  // --single-thread: ENet is serviced on the simulation thread between ticks, for comparing the two
+  const bool singleThread = has_option(argc, argv, "--single-thread");
+  NetThread net(server);
+  if (!singleThread)
+    net.start();
+  auto service = [&](uint32_t timeout_ms) {
+    if (singleThread)
+      service_network(server, timeout_ms);
+    else
+      net.service(timeout_ms, [&](NetEvent &e) { inputLatency.received(e.recvNs); handle_event(server, e); });
+  };
 
-  uint32_t lastTime = enet_time_get();
+  // --sim-threads N (0 is one per core), 1 by default: the parallel path hasn't been shown to scale on
+  // real cores yet. Simulation results don't depend on it.
+  JobSystem jobs(option_value(argc, argv, "--sim-threads", 1));
+  printf("Simulating on %u threads\n", jobs.thread_count());
+
+  int64_t lastReportNs = tick_clock::now_ns();
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
-    ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
+    const std::vector<Room*> &due = scheduler.wait(rooms, service);
+    inputLatency.tick_started(scheduler.batch_start_ns());
+    if (!due.empty())
     {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            on_input(event.packet, event.peer);
-            break;
-        };
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
+      // a room per job, the workers steal whole rooms from each other and the chunks inside the big ones
+      jobs.parallel_for(static_cast<uint32_t>(due.size()), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i)
+          tick_room(*due[i], jobs, scheduler.dt());
+      });
+      for (Room *room : due)
+        room->outbox.send_all();
     }
-    static int t = 0;
-    for (Entity &e : entities)
+    scheduler.batch_done();
+
+    if (scheduler.batch_start_ns() - lastReportNs >= int64_t(metrics_report_interval) * 1'000'000'000)
     {
-      // simulate
-      simulate_entity(e, dt);
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
+      lastReportNs = scheduler.batch_start_ns();
+      const size_t awake = std::count_if(rooms.begin(), rooms.end(), [](const std::unique_ptr<Room> &room) { return room->awake(); });
+      print_room_metrics(scheduler.metrics(), awake, rooms.size());
+      scheduler.reset_metrics();
+      inputLatency.print();
+      inputLatency.reset();
+      if (!singleThread)
+        net.print_metrics();
+      uint32_t oversized = 0;
+      for (const std::unique_ptr<Room> &room : rooms)
       {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+        oversized += room->oversizedSnapshots;
+        room->oversizedSnapshots = 0;
       }
+      if (oversized > 0)
+        printf("%u coded snapshots didn't fit into a packet\n", oversized);
     }
-    usleep(10000);
   }
 
   enet_host_destroy(server);
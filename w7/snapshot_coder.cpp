@@ -0,0 +1,94 @@
+#include "snapshot_coder.h"
+
+// prediction for entities the baseline doesn't have yet: the middle of the map
+static const QuantizedEntity defaultPrediction = {0, 1 << 10, 1 << 9, 0, 0, 0};
+
+void encode_snapshot_body(const SnapshotCodingState &base, const QuantizedEntity *entities, size_t count,
+                          Bitstream &bs, SnapshotCodingState &result)
+{
+  result.models = base.models;
+  result.entities.assign(entities, entities + count);
+  SnapshotModels &models = result.models;
+
+  RangeEncoder rc(bs);
+  models.count.encode(rc, static_cast<uint32_t>(count));
+
+  uint16_t prevEid = 0xffff;
+  auto baseIt = base.entities.begin();
+  for (size_t i = 0; i < count; ++i)
+  {
+    const QuantizedEntity &e = entities[i];
+    models.eidGap.encode(rc, static_cast<uint16_t>(e.eid - prevEid - 1));
+    prevEid = e.eid;
+
+    while (baseIt != base.entities.end() && baseIt->eid < e.eid)
+      ++baseIt;
+    const bool inBase = baseIt != base.entities.end() && baseIt->eid == e.eid;
+    const QuantizedEntity &pred = inBase ? *baseIt : defaultPrediction;
+    if (inBase)
+    {
+      const bool unchanged = e.x == pred.x && e.y == pred.y && e.ori == pred.ori &&
+                             e.cellX == pred.cellX && e.cellY == pred.cellY;
+      rc.encode_bit(models.unchanged, unchanged ? 1 : 0);
+      if (unchanged)
+        continue;
+    }
+    models.dx.encode(rc, int32_t(e.x) - int32_t(pred.x));
+    models.dy.encode(rc, int32_t(e.y) - int32_t(pred.y));
+    models.dori.encode(rc, static_cast<int8_t>(e.ori - pred.ori));
+    const bool cellChanged = e.cellX != pred.cellX || e.cellY != pred.cellY;
+    rc.encode_bit(models.cellChanged, cellChanged ? 1 : 0);
+    if (cellChanged)
+    {
+      models.dcx.encode(rc, e.cellX - pred.cellX);
+      models.dcy.encode(rc, e.cellY - pred.cellY);
+    }
+  }
+  rc.flush();
+}
+
+bool decode_snapshot_body(const SnapshotCodingState &base, Bitstream &bs, SnapshotCodingState &result)
+{
+  result.models = base.models;
+  result.entities.clear();
+  SnapshotModels &models = result.models;
+
+  RangeDecoder rc(bs);
+  const uint32_t count = models.count.decode(rc);
+  if (count > 0xffff)
+    return false;
+  result.entities.reserve(count);
+
+  uint32_t prevEid = 0xffff;
+  auto baseIt = base.entities.begin();
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const uint32_t eid = (prevEid + 1 + models.eidGap.decode(rc)) & 0xffff;
+    if (i > 0 && eid <= prevEid)
+      return false;
+    prevEid = eid;
+
+    while (baseIt != base.entities.end() && baseIt->eid < eid)
+      ++baseIt;
+    const bool inBase = baseIt != base.entities.end() && baseIt->eid == eid;
+    const QuantizedEntity &pred = inBase ? *baseIt : defaultPrediction;
+    QuantizedEntity e = pred;
+    e.eid = static_cast<uint16_t>(eid);
+    if (!inBase || rc.decode_bit(models.unchanged) == 0)
+    {
+      e.x = static_cast<uint16_t>(int32_t(pred.x) + models.dx.decode(rc));
+      e.y = static_cast<uint16_t>(int32_t(pred.y) + models.dy.decode(rc));
+      e.ori = static_cast<uint8_t>(pred.ori + models.dori.decode(rc));
+      if (rc.decode_bit(models.cellChanged))
+      {
+        e.cellX = pred.cellX + models.dcx.decode(rc);
+        e.cellY = pred.cellY + models.dcy.decode(rc);
+      }
+    }
+    result.entities.push_back(e);
+
+    if (rc.overflow())
+      return false;
+  }
+  return !rc.overflow();
+}
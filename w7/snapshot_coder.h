@@ -0,0 +1,78 @@
+#pragma once
+#include "range_coder.h"
+#include "sequence.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Range-coded snapshot of all entities. Every field is coded as a delta against the same entity
+// in a baseline snapshot the client has acked, with models that were adapted by all snapshots up to
+// that baseline. Server and client keep the state after every snapshot in a SnapshotHistory, so
+// both start each packet from the same models and entity codes.
+
+// Full-precision codes of one entity, PositionQuantized split into x and y. The coded snapshot
+// carries the cell itself, no separate cell message is needed in this mode.
+struct QuantizedEntity
+{
+  uint16_t eid;
+  uint16_t x;
+  uint16_t y;
+  uint8_t ori;
+  int32_t cellX;
+  int32_t cellY;
+};
+
+struct SnapshotModels
+{
+  UintModel count;
+  UintModel eidGap;   // eids ascend, gap to the previous one minus 1
+  BitModel unchanged; // same codes as in the baseline
+  BitModel cellChanged;
+  SintModel dcx;
+  SintModel dcy;
+  SintModel dx;
+  SintModel dy;
+  SintModel dori;     // wraps around
+};
+
+struct SnapshotCodingState
+{
+  SnapshotModels models;
+  std::vector<QuantizedEntity> entities; // sorted by eid
+};
+
+// upper bound of coded bytes per entity, for sizing buffers
+constexpr size_t snapshot_max_entity_bytes = 32;
+
+// entities must be sorted by eid, result gets the state both sides will have after this snapshot
+void encode_snapshot_body(const SnapshotCodingState &base, const QuantizedEntity *entities, size_t count,
+                          Bitstream &bs, SnapshotCodingState &result);
+bool decode_snapshot_body(const SnapshotCodingState &base, Bitstream &bs, SnapshotCodingState &result);
+
+constexpr size_t snapshot_history_size = 32;
+
+class SnapshotHistory {
+public:
+  // a late packet doesn't evict a newer state from its slot
+  void store(uint16_t seq, SnapshotCodingState &&state) {
+    const size_t slot = seq % snapshot_history_size;
+    if (valid_[slot] && sequence_less(seq, seqs_[slot]))
+      return;
+    states_[slot] = std::move(state);
+    seqs_[slot] = seq;
+    valid_[slot] = true;
+  }
+
+  // nullptr once the slot was reused by a newer snapshot
+  const SnapshotCodingState *find(uint16_t seq) const {
+    const size_t slot = seq % snapshot_history_size;
+    return valid_[slot] && seqs_[slot] == seq ? &states_[slot] : nullptr;
+  }
+
+private:
+  std::array<SnapshotCodingState, snapshot_history_size> states_;
+  std::array<uint16_t, snapshot_history_size> seqs_{};
+  std::array<bool, snapshot_history_size> valid_{};
+};